@@ -1,7 +1,13 @@
 #pragma once
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <deque>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 #define TYPE_INT 0
 #define TYPE_FLOAT 1
 #define TYPE_CHAR 2
@@ -65,6 +71,73 @@ enum opr {
     NOP_SIGN
 };
 
+// the grammar alternative a node was reduced by, stamped by the parser
+// actions so later passes can switch on it
+enum production {
+    PROD_NONE,
+    PROD_PROGRAM,
+    PROD_EXTDEFLIST,
+    PROD_EXTDEF_VARS,
+    PROD_EXTDEF_TYPE,
+    PROD_EXTDEF_FUNC,
+    PROD_EXTDECLIST_ONE,
+    PROD_EXTDECLIST_MORE,
+    PROD_SPECIFIER_TYPE,
+    PROD_SPECIFIER_STRUCT,
+    PROD_STRUCT_DEF,
+    PROD_STRUCT_USE,
+    PROD_VARDEC_ID,
+    PROD_VARDEC_ARRAY,
+    PROD_FUNDEC_PARAMS,
+    PROD_FUNDEC_EMPTY,
+    PROD_VARLIST_MORE,
+    PROD_VARLIST_ONE,
+    PROD_PARAMDEC,
+    PROD_COMPST,
+    PROD_STMTLIST,
+    PROD_STMT_EXP,
+    PROD_STMT_COMPST,
+    PROD_STMT_CONTINUE,
+    PROD_STMT_BREAK,
+    PROD_STMT_RETURN,
+    PROD_STMT_IF,
+    PROD_STMT_IFELSE,
+    PROD_STMT_DO,
+    PROD_STMT_WHILE,
+    PROD_STMT_FOR,
+    PROD_DEFLIST,
+    PROD_DEF,
+    PROD_DECLIST_ONE,
+    PROD_DECLIST_MORE,
+    PROD_DEC,
+    PROD_DEC_INIT,
+    PROD_EXP_ASSIGN,
+    PROD_EXP_AND,
+    PROD_EXP_OR,
+    PROD_EXP_LT,
+    PROD_EXP_LE,
+    PROD_EXP_GT,
+    PROD_EXP_GE,
+    PROD_EXP_NE,
+    PROD_EXP_EQ,
+    PROD_EXP_PLUS,
+    PROD_EXP_MINUS,
+    PROD_EXP_MUL,
+    PROD_EXP_DIV,
+    PROD_EXP_PAREN,
+    PROD_EXP_NEG,
+    PROD_EXP_NOT,
+    PROD_EXP_CALL,
+    PROD_EXP_CALL_EMPTY,
+    PROD_EXP_INDEX,
+    PROD_EXP_MEMBER,
+    PROD_EXP_ID,
+    PROD_EXP_INT,
+    PROD_EXP_FLOAT,
+    PROD_EXP_CHAR,
+    PROD_ARGS
+};
+
 const char* oprName(enum opr op) {
     switch (op) {
         case PROGRAM:
@@ -195,38 +268,117 @@ const char* typeName(int type) {
     }
 }
 
+// identifiers are interned into small integer atoms once, when scanned;
+// later passes index tables by atom instead of hashing the name again.
+// Atoms are per thread and reset by every compilation, so the tables
+// indexed by them grow with its own identifiers only
+#define ATOM_READ 0
+#define ATOM_WRITE 1
+
+thread_local std::deque<std::string> atom_names = { "read", "write" };
+
+thread_local std::unordered_map<std::string_view, int> atom_ids = { { "read", ATOM_READ }, { "write", ATOM_WRITE } };
+
+int internAtom(const char* text, int len) {
+    auto iter = atom_ids.find(std::string_view(text, len));
+    if (iter != atom_ids.end()) {
+        return iter->second;
+    }
+    atom_names.emplace_back(text, len);
+    int atom = atom_names.size() - 1;
+    atom_ids.emplace(atom_names.back(), atom);
+    return atom;
+}
+
+int atomCount() {
+    return atom_names.size();
+}
+
+const std::string& atomName(int atom) {
+    return atom_names[atom];
+}
+
+void resetAtoms() {
+    std::deque<std::string>{ "read", "write" }.swap(atom_names);
+    std::unordered_map<std::string_view, int>{ { atom_names[ATOM_READ], ATOM_READ }, { atom_names[ATOM_WRITE], ATOM_WRITE } }.swap(atom_ids);
+}
+
+struct AbstractSyntaxTree;
+
+struct Type;
+
+// nodes of the tree being built live in fixed-size chunks of a per-thread
+// arena and are named by 32-bit indices; the children of a node are one
+// contiguous run of indices in ast_child_indices
+#define AST_CHUNK_BITS 12
+
+thread_local std::vector<std::unique_ptr<struct AbstractSyntaxTree[]>> ast_chunks;
+
+thread_local uint32_t ast_count = 0;
+
+thread_local std::vector<uint32_t> ast_child_indices;
+
+struct AbstractSyntaxTree* astNode(uint32_t index) {
+    return &ast_chunks[index >> AST_CHUNK_BITS][index & ((1 << AST_CHUNK_BITS) - 1)];
+}
+
+struct ASTChildren {
+    uint32_t first;
+
+    struct AbstractSyntaxTree* operator[](int i) const {
+        return astNode(ast_child_indices[first + i]);
+    }
+};
+
 typedef struct AbstractSyntaxTree {
+    const char* str; // token text viewed in the source buffer, not NUL-terminated
     int lineno;
-    enum opr op;
-    int val;
-    char* str;
-    struct AbstractSyntaxTree** children;
+    enum opr op : 16;
+    enum production prod : 16;
+    int val; // INT value, TYPE of a Specifier, or the atom of an ID
+    int len;
+    uint32_t index;
+    ASTChildren children;
     int num_children;
-    
-    std::string to_string() {
-        std::string result = std::string(oprName(op)) + "_";
-        for (int i = 0; i < num_children; i++) {
-            result += oprName(children[i]->op);
-        }
-        return result;
-    }
+    int capacity; // slots reserved for children, more than num_children only for lists
+    const struct Type* type; // set by the checker: the type of an Exp, or the type a VarDec declares
 } AST;
 
-AST* makeAST(enum opr op, int lineno) {
-    AST* ast = (AST*) malloc(sizeof(AST));
-    memset(ast, 0, sizeof(AST));
+AST* makeAST(enum opr op, int lineno, enum production prod = PROD_NONE) {
+    if (!(ast_count & ((1 << AST_CHUNK_BITS) - 1)) && ast_count >> AST_CHUNK_BITS == ast_chunks.size()) {
+        ast_chunks.emplace_back(new AST[1 << AST_CHUNK_BITS]);
+    }
+    AST* ast = astNode(ast_count);
+    *ast = AST();
+    ast->index = ast_count++;
     ast->lineno = lineno;
     ast->op = op;
+    ast->prod = prod;
     return ast;
 }
 
+// drop every node at once and give their memory back for the IR
+void freeAST() {
+    ast_count = 0;
+    ast_chunks.clear();
+    std::vector<uint32_t>().swap(ast_child_indices);
+}
+
+// forget every node but keep the arena, so the next nodes reuse it
+void rewindAST() {
+    ast_count = 0;
+    ast_child_indices.clear();
+}
+
 AST* makeSign(enum opr sign) {
     return makeAST(sign, 0);
 }
 
-AST* makeSymbol(char *name, int lineno) {
+AST* makeSymbol(const char* text, int len, int lineno) {
     AST* ast = makeAST(SYMBOL, lineno);
-    ast->str = strdup(name);
+    ast->str = text;
+    ast->len = len;
+    ast->val = internAtom(text, len);
     return ast;
 }
 
@@ -236,23 +388,50 @@ AST* makeInt(int val, int lineno) {
     return ast;
 }
 
-AST* makeFloat(char *str, int lineno) {
+AST* makeFloat(const char* text, int len, int lineno) {
     AST* ast = makeAST(FLOAT_CONST, lineno);
-    ast->str = strdup(str);
+    ast->str = text;
+    ast->len = len;
     return ast;
 }
 
-AST* makeChar(char *str, int lineno) {
+AST* makeChar(const char* text, int len, int lineno) {
     AST* ast = makeAST(CHAR_CONST, lineno);
-    ast->str = strdup(str);
+    ast->str = text;
+    ast->len = len;
     return ast;
 }
 
+std::string astText(const AST* ast) {
+    return std::string(ast->str, ast->len);
+}
+
+// the children of a node are inserted one after another with no other
+// insertions in between, so the run normally grows in place at the end;
+// a list is appended to after each element's own children, so its run
+// moves to the end with room to double and appending stays amortized O(1)
 AST* insertChild(AST* parent, AST* element) {
     if (element) {
-        parent->children = (AST**) realloc(parent->children, ++parent->num_children * sizeof(AST));
-        parent->children[parent->num_children - 1] = element;
+        if (!parent->capacity) {
+            parent->children.first = ast_child_indices.size();
+        }
+        if (parent->num_children == parent->capacity) {
+            if (parent->children.first + parent->capacity == ast_child_indices.size()) {
+                ast_child_indices.push_back(0);
+                parent->capacity++;
+            } else {
+                uint32_t first = ast_child_indices.size();
+                ast_child_indices.resize(first + 2 * parent->num_children);
+                for (int i = 0; i < parent->num_children; i++) {
+                    ast_child_indices[first + i] = ast_child_indices[parent->children.first + i];
+                }
+                parent->children.first = first;
+                parent->capacity = 2 * parent->num_children;
+            }
+        }
+        ast_child_indices[parent->children.first + parent->num_children++] = element->index;
     }
+    return parent;
 }
 
 void printIndent(int depth) {
@@ -264,23 +443,23 @@ void printIndent(int depth) {
 void printAST(const AST* ast, int depth) {
     printIndent(depth);
     if (ast->op == SYMBOL) {
-        printf("ID: %s\n", ast->str);
+        printf("ID: %.*s\n", ast->len, ast->str);
     } else {
         if (ast->op == INT_CONST) {
             printf("INT: %d\n", ast->val);
         }
         else if (ast->op == FLOAT_CONST) {
-            printf("FLOAT: %s\n", ast->str);
+            printf("FLOAT: %.*s\n", ast->len, ast->str);
         }
         else if (ast->op == CHAR_CONST) {
-            printf("CHAR: %s\n", ast->str);
+            printf("CHAR: %.*s\n", ast->len, ast->str);
         }
         else if (ast->lineno) {
             printf("%s (%d)\n", oprName(ast->op), ast->lineno);
         } else {
             printf("%s\n", oprName(ast->op));
         }
-        if (ast->op == SPECIFIER && !ast->children) {
+        if (ast->op == SPECIFIER && !ast->num_children) {
             printIndent(depth + 1);
             printf("TYPE: %s\n", typeName(ast->val));
         }
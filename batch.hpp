@@ -0,0 +1,225 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+// batch mode: inputs are compiled by worker threads, each owning a deque of
+// file indices; a worker pops from the bottom of its own deque and steals
+// from the top of the others once it runs dry
+
+enum BatchState {
+    BATCH_PENDING,
+    BATCH_RUNNING,
+    BATCH_OK,
+    BATCH_FAILED,
+};
+
+struct BatchDeque {
+    std::atomic<int> top;
+
+    std::atomic<int> bottom;
+
+    int begin; // slice of BatchShared::items owned by this deque
+};
+
+struct BatchResult {
+    std::atomic<int> state;
+
+    int status = 0;
+
+    long long micros = 0;
+};
+
+struct BatchShared {
+    int workers;
+
+    int count;
+
+    std::unique_ptr<BatchDeque[]> deques;
+
+    std::unique_ptr<BatchResult[]> results;
+
+    std::vector<int> items;
+};
+
+long long batchMicros() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+bool batchHasSuffix(const std::string& path, const char* suffix) {
+    size_t len = strlen(suffix);
+    return path.size() >= len && path.compare(path.size() - len, len, suffix) == 0;
+}
+
+// expand directories into the .spl files below them, in sorted order
+bool batchCollectInputs(const std::string& path, std::vector<std::string>& inputs) {
+    struct stat info;
+    if (stat(path.c_str(), &info)) {
+        perror(path.c_str());
+        return false;
+    }
+    if (!S_ISDIR(info.st_mode)) {
+        inputs.push_back(path);
+        return true;
+    }
+    DIR* dir = opendir(path.c_str());
+    if (!dir) {
+        perror(path.c_str());
+        return false;
+    }
+    std::vector<std::string> entries;
+    while (dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] != '.') {
+            entries.push_back(path + "/" + entry->d_name);
+        }
+    }
+    closedir(dir);
+    std::sort(entries.begin(), entries.end());
+    bool ok = true;
+    for (const std::string& entry : entries) {
+        if (stat(entry.c_str(), &info) == 0 && (S_ISDIR(info.st_mode) || batchHasSuffix(entry, ".spl"))) {
+            ok &= batchCollectInputs(entry, inputs);
+        }
+    }
+    return ok;
+}
+
+std::string batchOutputPath(const std::string& path) {
+    if (batchHasSuffix(path, ".spl")) {
+        return path.substr(0, path.size() - 4) + ".ir";
+    }
+    return path + ".ir";
+}
+
+void batchInitShared(BatchShared& shared, int workers, int count) {
+    shared.workers = workers;
+    shared.count = count;
+    shared.deques.reset(new BatchDeque[workers]);
+    shared.results.reset(new BatchResult[count]);
+    // contiguous slices keep the files of a directory on one worker until stolen
+    for (int i = 0; i < workers; i++) {
+        BatchDeque& deque = shared.deques[i];
+        deque.begin = (long long) count * i / workers;
+        deque.top = 0;
+        deque.bottom = (long long) count * (i + 1) / workers - deque.begin;
+    }
+    for (int i = 0; i < count; i++) {
+        shared.results[i].state = BATCH_PENDING;
+        shared.items.push_back(i);
+    }
+}
+
+// owner side: take the newest item, racing thieves only for the last one
+int batchPop(BatchShared* shared, int worker) {
+    BatchDeque& deque = shared->deques[worker];
+    int bottom = deque.bottom.load() - 1;
+    deque.bottom.store(bottom);
+    int top = deque.top.load();
+    if (top > bottom) {
+        deque.bottom.store(top);
+        return -1;
+    }
+    int item = shared->items[deque.begin + bottom];
+    if (top == bottom) {
+        if (!deque.top.compare_exchange_strong(top, top + 1)) {
+            item = -1;
+        }
+        deque.bottom.store(top + 1);
+    }
+    return item;
+}
+
+// thief side: take the oldest item of another worker
+int batchSteal(BatchShared* shared, int victim) {
+    BatchDeque& deque = shared->deques[victim];
+    int top = deque.top.load();
+    int bottom = deque.bottom.load();
+    if (top >= bottom) {
+        return -1;
+    }
+    int item = shared->items[deque.begin + top];
+    return deque.top.compare_exchange_strong(top, top + 1) ? item : -1;
+}
+
+int batchNext(BatchShared* shared, int worker) {
+    int item = batchPop(shared, worker);
+    for (int i = 1; item < 0 && i < shared->workers; i++) {
+        int victim = (worker + i) % shared->workers;
+        // retry while the victim still has work, a failed steal only means contention
+        while (item < 0 && shared->deques[victim].top.load() < shared->deques[victim].bottom.load()) {
+            item = batchSteal(shared, victim);
+        }
+    }
+    return item;
+}
+
+void batchWorker(BatchShared* shared, int worker, const std::vector<std::string>& inputs, int (*compile)(const char*)) {
+    for (int item; (item = batchNext(shared, worker)) >= 0; ) {
+        BatchResult& result = shared->results[item];
+        result.state = BATCH_RUNNING;
+        long long start = batchMicros();
+        result.status = compile(inputs[item].c_str());
+        result.micros = batchMicros() - start;
+        result.state = result.status ? BATCH_FAILED : BATCH_OK;
+    }
+}
+
+void batchReport(BatchShared* shared, const std::vector<std::string>& inputs, long long micros) {
+    int failed = 0;
+    long long total = 0;
+    std::vector<int> order;
+    for (int i = 0; i < shared->count; i++) {
+        BatchResult& result = shared->results[i];
+        total += result.micros;
+        order.push_back(i);
+        if (result.state == BATCH_OK) continue;
+        failed++;
+        if (result.state == BATCH_FAILED) {
+            fprintf(stderr, "%s: failed, see %s\n", inputs[i].c_str(), batchOutputPath(inputs[i]).c_str());
+        } else {
+            fprintf(stderr, "%s: not compiled\n", inputs[i].c_str());
+        }
+    }
+    std::sort(order.begin(), order.end(), [shared](int a, int b) {
+        return shared->results[a].micros > shared->results[b].micros;
+    });
+    fprintf(stderr, "%d files, %d failed, %d workers, %.3f s wall, %.3f s compiling\n",
+        shared->count, failed, shared->workers, micros / 1e6, total / 1e6);
+    for (int i = 0; i < order.size() && i < 5; i++) {
+        BatchResult& result = shared->results[order[i]];
+        fprintf(stderr, "  %8.3f ms  %s\n", result.micros / 1e3, inputs[order[i]].c_str());
+    }
+}
+
+// returns the number of inputs that did not compile
+int batchCompile(const std::vector<std::string>& inputs, int jobs, int (*compile)(const char*)) {
+    long long start = batchMicros();
+    int workers = std::max(1, std::min(jobs, (int) inputs.size()));
+    BatchShared shared;
+    batchInitShared(shared, workers, inputs.size());
+    std::vector<std::thread> threads;
+    for (int i = 0; i < workers; i++) {
+        threads.emplace_back(batchWorker, &shared, i, std::cref(inputs), compile);
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    batchReport(&shared, inputs, batchMicros() - start);
+    int failed = 0;
+    for (int i = 0; i < shared.count; i++) {
+        failed += shared.results[i].state != BATCH_OK;
+    }
+    return failed;
+}
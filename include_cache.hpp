@@ -0,0 +1,178 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// headers are scanned once per process into token lists which every later
+// #include of the same canonical path replays; with a cache directory the
+// lists are also persisted, so a header costs one scan per build
+
+#define INCLUDE_CACHE_MAGIC 0x53504c54 // "SPLT"
+
+struct SplToken {
+    int token; // 0 marks a nested #include of text
+    int line;
+    int val; // INT value or TYPE kind
+    std::string text; // ID/FLOAT/CHAR spelling, or the canonical path of a nested #include
+};
+
+struct SplHeader {
+    std::string path;
+
+    long long mtime;
+
+    long long size;
+
+    bool clean = true; // scanned without lexical errors, safe to reuse
+
+    std::vector<SplToken> tokens;
+};
+
+// entries are never freed: ASTs of earlier compilations point into their texts
+std::unordered_map<std::string, SplHeader*> header_cache;
+
+std::mutex header_cache_lock;
+
+bool includeCanonicalPath(const char* path, std::string& canonical) {
+    char buffer[PATH_MAX];
+    if (!realpath(path, buffer)) {
+        return false;
+    }
+    canonical = buffer;
+    return true;
+}
+
+bool includeStat(const std::string& path, long long& mtime, long long& size) {
+    struct stat info;
+    if (stat(path.c_str(), &info)) {
+        return false;
+    }
+    mtime = (long long) info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+    size = info.st_size;
+    return true;
+}
+
+std::string includeCacheFile(const char* dir, const std::string& path) {
+    char name[32];
+    snprintf(name, sizeof(name), "/%016zx.tok", std::hash<std::string>()(path));
+    return dir + std::string(name);
+}
+
+bool includeReadInt(FILE* file, int& value) {
+    return fread(&value, sizeof(value), 1, file) == 1;
+}
+
+bool includeReadString(FILE* file, std::string& text) {
+    int len;
+    if (!includeReadInt(file, len) || len < 0) {
+        return false;
+    }
+    text.resize(len);
+    return fread(&text[0], 1, len, file) == len;
+}
+
+SplHeader* includeLoad(const char* dir, const std::string& path, long long mtime, long long size) {
+    FILE* file = fopen(includeCacheFile(dir, path).c_str(), "rb");
+    if (!file) {
+        return nullptr;
+    }
+    std::unique_ptr<SplHeader> header(new SplHeader());
+    int magic = 0, count = 0;
+    bool ok = includeReadInt(file, magic) && magic == INCLUDE_CACHE_MAGIC;
+    ok = ok && includeReadString(file, header->path) && header->path == path;
+    ok = ok && fread(&header->mtime, sizeof(long long), 1, file) == 1 && header->mtime == mtime;
+    ok = ok && fread(&header->size, sizeof(long long), 1, file) == 1 && header->size == size;
+    ok = ok && includeReadInt(file, count) && count >= 0;
+    for (int i = 0; ok && i < count; i++) {
+        SplToken token;
+        ok = includeReadInt(file, token.token) && includeReadInt(file, token.line) && includeReadInt(file, token.val);
+        ok = ok && includeReadString(file, token.text);
+        header->tokens.push_back(std::move(token));
+    }
+    fclose(file);
+    return ok ? header.release() : nullptr;
+}
+
+void includeWriteString(FILE* file, const std::string& text) {
+    int len = text.size();
+    fwrite(&len, sizeof(len), 1, file);
+    fwrite(text.data(), 1, len, file);
+}
+
+// written to a temporary name first so concurrent builds never read half a file
+void includeStore(const char* dir, const SplHeader* header) {
+    std::string target = includeCacheFile(dir, header->path);
+    std::string temp = target + "." + std::to_string(getpid()) + "." + std::to_string(std::hash<const void*>()(header));
+    FILE* file = fopen(temp.c_str(), "wb");
+    if (!file) {
+        return;
+    }
+    int magic = INCLUDE_CACHE_MAGIC, count = header->tokens.size();
+    fwrite(&magic, sizeof(magic), 1, file);
+    includeWriteString(file, header->path);
+    fwrite(&header->mtime, sizeof(long long), 1, file);
+    fwrite(&header->size, sizeof(long long), 1, file);
+    fwrite(&count, sizeof(count), 1, file);
+    for (const SplToken& token : header->tokens) {
+        fwrite(&token.token, sizeof(int), 1, file);
+        fwrite(&token.line, sizeof(int), 1, file);
+        fwrite(&token.val, sizeof(int), 1, file);
+        includeWriteString(file, token.text);
+    }
+    if (fclose(file) || rename(temp.c_str(), target.c_str())) {
+        unlink(temp.c_str());
+    }
+}
+
+// the cached token list of a header, scanning it with the given function on
+// a miss; a header that changed on disk since it was cached is scanned again
+template<typename F>
+const SplHeader* includeLookup(const std::string& path, const char* dir, F scan) {
+    long long mtime, size;
+    if (!includeStat(path, mtime, size)) {
+        return nullptr;
+    }
+    {
+        std::lock_guard<std::mutex> guard(header_cache_lock);
+        auto iter = header_cache.find(path);
+        if (iter != header_cache.end() && iter->second->mtime == mtime && iter->second->size == size) {
+            return iter->second;
+        }
+    }
+    SplHeader* header = dir ? includeLoad(dir, path, mtime, size) : nullptr;
+    if (!header) {
+        header = new SplHeader();
+        header->path = path;
+        header->mtime = mtime;
+        header->size = size;
+        if (!scan(header)) {
+            delete header;
+            return nullptr;
+        }
+        if (!header->clean) {
+            return header; // replayed once so its errors are reported, never shared
+        }
+        if (dir) {
+            includeStore(dir, header);
+        }
+    }
+    std::lock_guard<std::mutex> guard(header_cache_lock);
+    auto iter = header_cache.find(path);
+    if (iter != header_cache.end() && iter->second->mtime == mtime && iter->second->size == size) {
+        delete header; // another thread cached it meanwhile
+        return iter->second;
+    }
+    header_cache[path] = header;
+    return header;
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <deque>
 #include <vector>
 #include <unordered_map>
 
@@ -33,9 +34,19 @@ enum IROpCode {
     IR_LOAD,
     IR_STORE,
     IR_ALLOC,
+    IR_VLOAD,
+    IR_VSTORE,
+    IR_VADD,
+    IR_VMINUS,
+    IR_VMUL,
+    IR_VSTEP,
+    IR_FILL,
+    IR_COPY,
     
 };
 
+#define VECTOR_MAX_LANES 8 // words in the widest vector operation, see Code::size
+
 enum ValueType {
     VT_SYMBOL,
     VT_LABEL,
@@ -48,6 +59,7 @@ enum ValueType {
 
 struct Value {
     ValueType type;
+    bool numbered = false; // see irRenumber
     union {
         int val;
         char* name;
@@ -84,18 +96,6 @@ struct Value {
     }
 };
 
-struct Array {
-    char* name;
-    
-    std::vector<int> dimensions;
-    
-    std::vector<int> sizes;
-    
-    bool param = false;
-    
-    Array(char* name) : name(name) {};
-};
-
 bool isConstant(const Value* v) {
     return v && v->type == VT_CONST;
 }
@@ -104,45 +104,60 @@ bool isConstant(const Value* v, const int val) {
     return isConstant(v) && v->val == val;
 }
 
+bool irCompare(IROpCode relop, int a, int b) {
+    switch (relop) {
+        case IR_LT: return a < b;
+        case IR_LE: return a <= b;
+        case IR_GT: return a > b;
+        case IR_GE: return a >= b;
+        case IR_NE: return a != b;
+        case IR_EQ: return a == b;
+        default: return false;
+    }
+}
+
+// values live as long as one compilation and are dropped together by
+// irResetCodegen; constants are never modified, so one per number is shared
+thread_local std::deque<Value> value_pool;
+
+thread_local std::unordered_map<int, Value*> constant_values;
+
+template<typename T>
+Value* makeValue(ValueType type, T content) {
+    value_pool.emplace_back(type, content);
+    return &value_pool.back();
+}
+
 Value* makeSV(char* name) {
-    return new Value(VT_SYMBOL, name);
+    return makeValue(VT_SYMBOL, name);
 }
 
 Value* makeLV(int val) {
-    return new Value(VT_LABEL, val);
+    return makeValue(VT_LABEL, val);
 }
 
 Value* makeCV(int val) {
-    return new Value(VT_CONST, val);
+    Value*& value = constant_values[val];
+    if (!value) {
+        value = makeValue(VT_CONST, val);
+    }
+    return value;
 }
 
 Value* makeVV(int val) {
-    return new Value(VT_VAR, val);
+    return makeValue(VT_VAR, val);
 }
 
 Value* makeTV(int val) {
-    return new Value(VT_TEMP, val);
+    return makeValue(VT_TEMP, val);
 }
 
 Value* makePV(int val) {
-    return new Value(VT_POINTER, val);
-}
-
-Array* makeArray(AST* ast) {
-    if (ast->num_children == 1) { // ID
-        return new Array(strdup(ast->children[0]->str));
-    } else { // VarDec LB INT RB
-        Array* arr = makeArray(ast->children[0]);
-        arr->dimensions.push_back(ast->children[2]->val);
-        return arr;
-    }
+    return makeValue(VT_POINTER, val);
 }
 
-std::unordered_map<std::string, Value*> symbol_table;
-
-std::unordered_map<std::string, Array*> array_table;
-
-std::unordered_map<Value*, Array*> symbol_array_table;
+// the variable declared for each atom, nullptr until first seen
+thread_local std::vector<Value*> symbol_table;
 
 template<typename T>
 std::string safe_to_string(T* ptr) {
@@ -150,6 +165,15 @@ std::string safe_to_string(T* ptr) {
     else return "null";
 }
 
+struct Code;
+
+// storage of deleted instructions, reused by the next ones allocated
+thread_local std::vector<Code*> code_free_list;
+
+// instructions unlinked by a pass, deleted at the next point where no
+// pass can still hold them
+thread_local std::vector<Code*> code_retired;
+
 struct Code {
     IROpCode opcode = IR_NOP;
     Value* arg1 = nullptr;
@@ -158,7 +182,22 @@ struct Code {
     IROpCode relop = IR_NOP;
     Code* prev = nullptr;
     Code* next = nullptr;
-    int size = 0;
+    int size = 0; // bytes of an ALLOC, lanes of a vector operation
+    bool retired = false;
+    long long hits = 0;
+    
+    static void* operator new(size_t size) {
+        if (code_free_list.empty()) {
+            return ::operator new(size);
+        }
+        void* storage = code_free_list.back();
+        code_free_list.pop_back();
+        return storage;
+    }
+    
+    static void operator delete(void* storage) {
+        code_free_list.push_back((Code*) storage);
+    }
     
     Code(IROpCode opcode) : opcode(opcode) {};
     Code(IROpCode opcode, Value* result) : opcode(opcode), result(result) {};
@@ -189,3 +228,60 @@ Code* combineCode(Code* c1, Code* c2) {
     
     return c1;
 }
+
+void irRetireCode(Code* code) {
+    if (!code->retired) {
+        code->retired = true;
+        code_retired.push_back(code);
+    }
+}
+
+void irRecycleCode() {
+    for (Code* code : code_retired) {
+        delete code;
+    }
+    code_retired.clear();
+}
+
+// delete a whole list once it has been printed
+void irFreeCode(Code* head) {
+    irRecycleCode();
+    while (head) {
+        Code* next = head->next;
+        delete head;
+        head = next;
+    }
+}
+
+// hand the storage kept for reuse back to the allocator, before the
+// thread that owns it exits
+void irReleaseCodeStorage() {
+    for (Code* storage : code_free_list) {
+        ::operator delete(storage);
+    }
+    code_free_list.clear();
+}
+
+// append to a list whose last node is known, so building a long list
+// one piece at a time does not walk it again for every piece
+void appendCode(Code*& head, Code*& tail, Code* code) {
+    if (code) {
+        if (tail) {
+            tail->next = code;
+            code->prev = tail;
+        } else {
+            head = code;
+        }
+        for (tail = code; tail->next; tail = tail->next);
+    }
+}
+
+Code* irInsertAfter(Code* pos, Code* code) {
+    code->prev = pos;
+    code->next = pos->next;
+    if (pos->next) {
+        pos->next->prev = code;
+    }
+    pos->next = code;
+    return code;
+}
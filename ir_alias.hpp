@@ -0,0 +1,236 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ast.h"
+#include "ir.hpp"
+#include "ir_cfg.hpp"
+#include "ir_optimizer.hpp"
+
+// where an address value points: a DEC'd variable and a byte offset into it
+struct IRAddress {
+    Value* base;
+
+    int offset;
+};
+
+// what a function does with the addresses of its DEC'd variables
+struct IRAliasInfo {
+    std::unordered_map<Value*, int> sizes; // DEC'd variables, by bytes
+
+    // the variables each value may point into; nullptr stands for memory
+    // reached through a parameter
+    std::unordered_map<Value*, std::vector<Value*>> pointees;
+
+    std::unordered_map<Code*, IRAddress> accesses; // loads and stores at a known, in-bounds offset
+
+    std::unordered_set<Value*> leaked; // address stored, passed, returned or compared
+
+    std::unordered_set<Value*> inexact; // also accessed or pointed into at an unknown offset
+};
+
+bool irDefinesResult(IROpCode opcode) {
+    return irIsAssign(opcode) || opcode == IR_READ || opcode == IR_PARAM;
+}
+
+// the address code reads memory through
+Value* irReadAddress(Code* code) {
+    switch (code->opcode) {
+        case IR_LOAD:
+        case IR_VLOAD:
+        case IR_COPY:
+            return code->arg1;
+        default:
+            return nullptr;
+    }
+}
+
+// the address code writes memory through
+Value* irWrittenAddress(Code* code) {
+    switch (code->opcode) {
+        case IR_STORE:
+        case IR_VSTORE:
+        case IR_FILL:
+        case IR_COPY:
+            return code->result;
+        default:
+            return nullptr;
+    }
+}
+
+bool irIsAddressArith(IROpCode opcode) {
+    return opcode == IR_LOADADDR || opcode == IR_MOVE || opcode == IR_ADD || opcode == IR_MINUS;
+}
+
+// the address code computes from where its operands point
+bool irTrackAddress(Code* code, const std::function<const IRAddress*(Value*)>& resolve, std::unordered_map<Value*, int>& sizes, IRAddress& address) {
+    const IRAddress* from;
+    switch (code->opcode) {
+        case IR_LOADADDR:
+            if (sizes.find(code->arg1) == sizes.end()) return false;
+            address = { code->arg1, 0 };
+            return true;
+        case IR_MOVE:
+            if (!(from = resolve(code->arg1))) return false;
+            address = *from;
+            return true;
+        case IR_ADD:
+            if ((from = resolve(code->arg1)) && isConstant(code->arg2)) {
+                address = { from->base, from->offset + code->arg2->val };
+                return true;
+            } else if ((from = resolve(code->arg2)) && isConstant(code->arg1)) {
+                address = { from->base, from->offset + code->arg1->val };
+                return true;
+            }
+            return false;
+        case IR_MINUS:
+            if (!(from = resolve(code->arg1)) || !isConstant(code->arg2)) return false;
+            address = { from->base, from->offset - code->arg2->val };
+            return true;
+        default:
+            return false;
+    }
+}
+
+// addresses only come from LOADADDR and parameters and are only moved,
+// offset and dereferenced, so following those four opcodes finds every
+// load and store that may reach a variable, and at which offset if it is
+// constant along the way
+void irAnalyzeAliases(Code* fundec, IRAliasInfo& info) {
+    std::unordered_map<Value*, int> defs;
+    for (Code* code = fundec->next; code && code->opcode != IR_FUNDEC; code = code->next) {
+        if (code->opcode == IR_ALLOC) {
+            info.sizes[code->result] = code->size;
+        }
+        if (irDefinesResult(code->opcode)) {
+            defs[code->result]++;
+        }
+    }
+
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (Code* code = fundec->next; code && code->opcode != IR_FUNDEC; code = code->next) {
+            std::vector<Value*> from;
+            if (code->opcode == IR_PARAM) {
+                from.push_back(nullptr);
+            } else if (code->opcode == IR_LOADADDR) {
+                from.push_back(info.sizes.count(code->arg1) ? code->arg1 : nullptr);
+            } else if (irIsAddressArith(code->opcode)) {
+                for (Value* value : { code->arg1, code->arg2 }) {
+                    auto iter = info.pointees.find(value);
+                    if (value && iter != info.pointees.end()) {
+                        from.insert(from.end(), iter->second.begin(), iter->second.end());
+                    }
+                }
+            }
+            for (Value* base : from) {
+                std::vector<Value*>& to = info.pointees[code->result];
+                if (std::find(to.begin(), to.end(), base) == to.end()) {
+                    to.push_back(base);
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // values defined once point to the same place everywhere
+    std::unordered_map<Value*, IRAddress> fixed;
+    auto resolveFixed = [&](Value* value) -> const IRAddress* {
+        auto iter = fixed.find(value);
+        return iter == fixed.end() ? nullptr : &iter->second;
+    };
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (Code* code = fundec->next; code && code->opcode != IR_FUNDEC; code = code->next) {
+            IRAddress address;
+            if (defs[code->result] == 1 && !fixed.count(code->result) && irTrackAddress(code, resolveFixed, info.sizes, address)) {
+                fixed[code->result] = address;
+                changed = true;
+            }
+        }
+    }
+
+    // other values only within the basic block that sets them
+    std::unordered_map<Value*, IRAddress> local;
+    auto resolve = [&](Value* value) -> const IRAddress* {
+        auto iter = local.find(value);
+        return iter != local.end() ? &iter->second : resolveFixed(value);
+    };
+    auto mark = [&](std::unordered_set<Value*>& bases, Value* value) {
+        if (info.sizes.find(value) != info.sizes.end()) {
+            bases.insert(value);
+        }
+        auto iter = info.pointees.find(value);
+        if (value && iter != info.pointees.end()) {
+            for (Value* base : iter->second) {
+                if (base) bases.insert(base);
+            }
+        }
+    };
+    auto access = [&](Code* code, Value* value) {
+        const IRAddress* address = resolve(value);
+        if (address && address->offset >= 0 && address->offset % 4 == 0 && address->offset < info.sizes[address->base]) {
+            info.accesses[code] = *address;
+        } else {
+            mark(info.inexact, value);
+        }
+    };
+    for (Code* code = fundec->next; code && code->opcode != IR_FUNDEC; code = code->next) {
+        IRAddress address;
+        switch (code->opcode) {
+            case IR_LABEL:
+                local.clear();
+                break;
+            case IR_ALLOC:
+                break;
+            case IR_LOAD:
+                access(code, code->arg1);
+                local.erase(code->result);
+                break;
+            case IR_STORE:
+                access(code, code->result);
+                mark(info.leaked, code->arg1);
+                break;
+            case IR_VLOAD: // several words at once
+                mark(info.inexact, code->arg1);
+                local.erase(code->result);
+                break;
+            case IR_VSTORE:
+            case IR_FILL:
+                mark(info.inexact, code->result);
+                mark(info.leaked, code->arg1);
+                break;
+            case IR_COPY:
+                mark(info.inexact, code->result);
+                mark(info.inexact, code->arg1);
+                break;
+            case IR_LOADADDR:
+            case IR_MOVE:
+            case IR_ADD:
+            case IR_MINUS:
+                if (irTrackAddress(code, resolve, info.sizes, address)) {
+                    local[code->result] = address;
+                } else {
+                    mark(info.inexact, code->arg1);
+                    mark(info.inexact, code->arg2);
+                    local.erase(code->result);
+                }
+                break;
+            default:
+                mark(info.leaked, code->arg1);
+                mark(info.leaked, code->arg2);
+                if (irDefinesResult(code->opcode)) {
+                    local.erase(code->result);
+                } else {
+                    mark(info.leaked, code->result);
+                }
+        }
+        if (irIsTerminator(code->opcode)) {
+            local.clear();
+        }
+    }
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "ast.h"
+#include "ir.hpp"
+
+struct BasicBlock {
+    int id;
+
+    Code* head;
+
+    Code* tail;
+
+    std::vector<BasicBlock*> succs;
+
+    std::vector<BasicBlock*> preds;
+
+    long long freq = 0;
+
+    int depth = 0;
+
+    BasicBlock(int id, Code* head) : id(id), head(head), tail(head) {};
+
+    Value* label() const {
+        return head->opcode == IR_LABEL ? head->result : nullptr;
+    }
+};
+
+struct IRFunctionCFG {
+    Code* fundec;
+
+    Code* end; // first code after the function, or null
+
+    std::vector<BasicBlock*> blocks;
+
+    ~IRFunctionCFG() {
+        for (BasicBlock* block : blocks) {
+            delete block;
+        }
+    }
+};
+
+bool irIsTerminator(IROpCode opcode) {
+    return opcode == IR_GOTO || opcode == IR_IFGOTO || opcode == IR_RETURN;
+}
+
+std::vector<Code*> irFindFunctionHeads(Code* code) {
+    std::vector<Code*> heads;
+    while (code) {
+        if (code->opcode == IR_FUNDEC) {
+            heads.push_back(code);
+        }
+        code = code->next;
+    }
+    return heads;
+}
+
+IRFunctionCFG* irBuildCFG(Code* fundec) {
+    IRFunctionCFG* cfg = new IRFunctionCFG();
+    cfg->fundec = fundec;
+
+    std::unordered_map<Value*, BasicBlock*> labels;
+    BasicBlock* block = nullptr;
+    Code* code = fundec->next;
+    while (code && code->opcode != IR_FUNDEC) {
+        if (!block || code->opcode == IR_LABEL || irIsTerminator(block->tail->opcode)) {
+            block = new BasicBlock(cfg->blocks.size(), code);
+            cfg->blocks.push_back(block);
+        }
+        block->tail = code;
+        if (code->opcode == IR_LABEL) {
+            labels[code->result] = block;
+        }
+        code = code->next;
+    }
+    cfg->end = code;
+
+    for (int i = 0; i < cfg->blocks.size(); i++) {
+        BasicBlock* block = cfg->blocks[i];
+        BasicBlock* fall = i + 1 < cfg->blocks.size() ? cfg->blocks[i + 1] : nullptr;
+        Code* tail = block->tail;
+        if (tail->opcode == IR_GOTO || tail->opcode == IR_IFGOTO) {
+            auto iter = labels.find(tail->result);
+            if (iter != labels.end()) {
+                block->succs.push_back(iter->second);
+            }
+        }
+        if (fall && tail->opcode != IR_GOTO && tail->opcode != IR_RETURN) {
+            if (block->succs.empty() || block->succs[0] != fall) {
+                block->succs.push_back(fall);
+            }
+        }
+        for (BasicBlock* succ : block->succs) {
+            succ->preds.push_back(block);
+        }
+    }
+    return cfg;
+}
+
+// loop nesting from back edges in code order, which is exact for the
+// structured control flow translateStmt emits
+void irComputeLoopDepth(IRFunctionCFG* cfg) {
+    for (BasicBlock* block : cfg->blocks) {
+        for (BasicBlock* succ : block->succs) {
+            if (succ->id <= block->id) {
+                for (int i = succ->id; i <= block->id; i++) {
+                    cfg->blocks[i]->depth++;
+                }
+            }
+        }
+    }
+}
+
+// relink the function body in the given block order
+void irRelinkBlocks(IRFunctionCFG* cfg, const std::vector<std::vector<Code*>>& order) {
+    Code* prev = cfg->fundec;
+    for (const auto& codes : order) {
+        for (Code* code : codes) {
+            prev->next = code;
+            code->prev = prev;
+            prev = code;
+        }
+    }
+    prev->next = cfg->end;
+    if (cfg->end) {
+        cfg->end->prev = prev;
+    }
+}
+
+std::vector<Code*> irBlockCodes(BasicBlock* block) {
+    std::vector<Code*> codes;
+    for (Code* code = block->head; ; code = code->next) {
+        codes.push_back(code);
+        if (code == block->tail) break;
+    }
+    return codes;
+}
@@ -1,32 +1,86 @@
 #pragma once
 #include "ast.h"
 #include "ir.hpp"
+#include "semantic.hpp"
 
-static Value* lookupVariable(char* name) {
-    static int counter = 1;
-    auto iter = symbol_table.find(name);
-    if (iter == symbol_table.end()) {
-        Value* ptr = makeVV(counter++);
-        symbol_table[name] = ptr;
-        return ptr;
-    } else {
-        return iter->second;
+#define COPY_UNROLL_WORDS 8 // longer array and struct copies are lowered to a loop
+
+thread_local int variable_counter = 1, temp_counter = 1, pointer_counter = 1, label_counter = 1;
+
+// every variable that is an array or a struct; such a parameter holds the
+// address of the caller's storage instead
+struct Aggregate {
+    bool param;
+};
+
+thread_local std::unordered_map<Value*, Aggregate> aggregate_table;
+
+// bytes taken by arrays and structs, each primitive being one 4-byte word
+thread_local std::unordered_map<const Type*, int> type_sizes;
+
+static Value* lookupVariable(int atom) {
+    if (atom >= symbol_table.size()) {
+        symbol_table.resize(atomCount());
     }
+    Value*& slot = symbol_table[atom];
+    if (!slot) {
+        slot = makeVV(variable_counter++);
+    }
+    return slot;
 }
 
 static Value* makeTemp() {
-    static int counter = 1;
-    return makeTV(counter++);
+    return makeTV(temp_counter++);
 }
 
 static Value* makePointer() {
-    static int counter = 1;
-    return makePV(counter++);
+    return makePV(pointer_counter++);
 }
 
 static Value* makeLabel() {
-    static int counter = 1;
-    return makeLV(counter++);
+    return makeLV(label_counter++);
+}
+
+// forget every name and numbering so the next translation unit starts fresh
+void irResetCodegen() {
+    symbol_table.clear();
+    aggregate_table.clear();
+    type_sizes.clear();
+    value_pool.clear();
+    constant_values.clear();
+    variable_counter = temp_counter = pointer_counter = label_counter = 1;
+}
+
+int typeSize(const Type* type) {
+    if (type->kind == PRIMITIVE_TYPE) {
+        return 4;
+    }
+    auto iter = type_sizes.find(type);
+    if (iter != type_sizes.end()) {
+        return iter->second;
+    }
+    int size = 0;
+    if (type->kind == ARRAY_TYPE) {
+        size = type->length * typeSize(type->element);
+    } else {
+        for (const Symbol& member : type->structdef->members) {
+            size += typeSize(member.type);
+        }
+    }
+    return type_sizes[type] = size;
+}
+
+// members are laid out one after another in the order the checker keeps them
+int memberOffset(const Type* type, int atom, const Type*& member) {
+    int offset = 0;
+    for (const Symbol& field : type->structdef->members) {
+        if (field.atom == atom) {
+            member = field.type;
+            break;
+        }
+        offset += typeSize(field.type);
+    }
+    return offset;
 }
 
 Code* translateExp(AST* exp, Value* &temp);
@@ -37,120 +91,198 @@ Code* translateArgs(AST* args, std::vector<Value*>& argList);
 
 Code* translateCondExp(AST* exp, Value* lb_t, Value* lb_f) {
     IROpCode opcode;
-    switch (exp->children[1]->op) {
-            case AND_OP: opcode = IR_AND; break;
-            case OR_OP: opcode = IR_OR; break;
-            case LT_OP: opcode = IR_LT; break;
-            case LE_OP: opcode = IR_LE; break;
-            case GT_OP: opcode = IR_GT; break;
-            case GE_OP: opcode = IR_GE; break;
-            case NE_OP: opcode = IR_NE; break;
-            case EQ_OP: opcode = IR_EQ; break;
-            case NOT_OP: opcode = IR_NOT; break;
-    }
-    if (opcode == IR_AND) {
-        Value* lb1 = makeLabel();
-        Code* c1 = translateCondExp(exp->children[0], lb1, lb_f);
-        Code* c2 = new Code(IR_LABEL, lb1);
-        Code* c3 = translateCondExp(exp->children[2], lb_t, lb_f);
-        return combineCode(combineCode(c1, c2), c3);
-    } else if (opcode == IR_OR) {
-        Value* lb1 = makeLabel();
-        Code* c1 = translateCondExp(exp->children[0], lb_t, lb1);
-        Code* c2 = new Code(IR_LABEL, lb1);
-        Code* c3 = translateCondExp(exp->children[2], lb_t, lb_f);
-        return combineCode(combineCode(c1, c2), c3);
-    } else if (opcode == IR_NOT) {
-        return translateCondExp(exp, lb_f, lb_t);
-    } else {
-        Value *t1 = makeTemp(), *t2 = makeTemp();
-        Code* c1 = translateExp(exp->children[0], t1);
-        Code* c2 = translateExp(exp->children[2], t2);
-        Code* c3 = new Code(IR_IFGOTO, t1, t2, lb_t, opcode);
-        Code* c4 = new Code(IR_GOTO, lb_f);
-        return combineCode(combineCode(combineCode(c1, c2), c3), c4);
+    switch (exp->prod) {
+        case PROD_EXP_AND: {
+            Value* lb1 = makeLabel();
+            Code* c1 = translateCondExp(exp->children[0], lb1, lb_f);
+            Code* c2 = new Code(IR_LABEL, lb1);
+            Code* c3 = translateCondExp(exp->children[2], lb_t, lb_f);
+            return combineCode(combineCode(c1, c2), c3);
+        }
+        case PROD_EXP_OR: {
+            Value* lb1 = makeLabel();
+            Code* c1 = translateCondExp(exp->children[0], lb_t, lb1);
+            Code* c2 = new Code(IR_LABEL, lb1);
+            Code* c3 = translateCondExp(exp->children[2], lb_t, lb_f);
+            return combineCode(combineCode(c1, c2), c3);
+        }
+        case PROD_EXP_NOT:
+            return translateCondExp(exp->children[1], lb_f, lb_t);
+        case PROD_EXP_PAREN:
+            return translateCondExp(exp->children[1], lb_t, lb_f);
+        case PROD_EXP_LT: opcode = IR_LT; break;
+        case PROD_EXP_LE: opcode = IR_LE; break;
+        case PROD_EXP_GT: opcode = IR_GT; break;
+        case PROD_EXP_GE: opcode = IR_GE; break;
+        case PROD_EXP_NE: opcode = IR_NE; break;
+        case PROD_EXP_EQ: opcode = IR_EQ; break;
+        default: { // any other value is true when non-zero
+            Value* t1 = makeTemp();
+            Code* c1 = translateExp(exp, t1);
+            Code* c2 = new Code(IR_IFGOTO, t1, makeCV(0), lb_t, IR_NE);
+            Code* c3 = new Code(IR_GOTO, lb_f);
+            return combineCode(combineCode(c1, c2), c3);
+        }
     }
+    Value *t1 = makeTemp(), *t2 = makeTemp();
+    Code* c1 = translateExp(exp->children[0], t1);
+    Code* c2 = translateExp(exp->children[2], t2);
+    Code* c3 = new Code(IR_IFGOTO, t1, t2, lb_t, opcode);
+    Code* c4 = new Code(IR_GOTO, lb_f);
+    return combineCode(combineCode(combineCode(c1, c2), c3), c4);
+}
+
+Aggregate* lookupAggregate(Value* value) {
+    auto iter = aggregate_table.find(value);
+    return iter == aggregate_table.end() ? nullptr : &iter->second;
 }
 
-Value* lookupVariable(AST* ast) {
-    if (ast->num_children == 1) {
-        return lookupVariable(ast->children[0]->str);
-    } else { // Exp LB Exp RB
-        return new Value(VT_COMPLEX, ast);
+// the array or struct an ID, element or member expression names, as the
+// checker typed it; nullptr for scalars and any other expression
+const Type* aggregateType(AST* exp) {
+    switch (exp->prod) {
+        case PROD_EXP_ID:
+        case PROD_EXP_INDEX:
+        case PROD_EXP_MEMBER:
+            return exp->type && exp->type->kind != PRIMITIVE_TYPE ? exp->type : nullptr;
+        case PROD_EXP_PAREN:
+            return aggregateType(exp->children[1]);
+        default:
+            return nullptr;
     }
 }
 
-Code* translateArray(AST* exp, Value*& temp, Array** ret_arr = nullptr, int* ret_depth = nullptr) {
-    if (exp->num_children == 1) {
-        if (exp->children[0]->op == INT_CONST) {
-            return new Code(IR_MOVE, makeCV(exp->children[0]->val), temp);
-        } else {
-            if (ret_arr && ret_depth) {
-                *ret_arr = array_table[exp->children[0]->str];
-                *ret_depth = 0;
+// an element or member address as base plus a constant displacement:
+// constant subscripts and member offsets only add to the displacement, each
+// other subscript adds its scaled value to the base
+Code* translateAccess(AST* exp, Value*& base, int& displacement, const Type*& type) {
+    switch (exp->prod) {
+        case PROD_EXP_INDEX: {
+            const Type* array;
+            Code* c1 = translateAccess(exp->children[0], base, displacement, array);
+            type = exp->type;
+            if (exp->children[2]->prod == PROD_EXP_INT) {
+                displacement += exp->children[2]->children[0]->val * typeSize(type);
+                return c1;
             }
-            if ((*ret_arr)->param) {
-                return new Code(IR_MOVE, lookupVariable(exp->children[0]->str), temp);
-            } else {
-                return new Code(IR_LOADADDR, lookupVariable(exp->children[0]->str), temp);
+            Value *t1 = makeTemp(), *offset = makePointer(), *addr = makePointer();
+            Code* c2 = translateExp(exp->children[2], t1);
+            Code* c3 = new Code(IR_MUL, t1, makeCV(typeSize(type)), offset);
+            Code* c4 = new Code(IR_ADD, base, offset, addr);
+            base = addr;
+            return combineCode(combineCode(combineCode(c1, c2), c3), c4);
+        }
+        case PROD_EXP_MEMBER: {
+            const Type* record;
+            Code* c1 = translateAccess(exp->children[0], base, displacement, record);
+            displacement += memberOffset(record, exp->children[2]->val, type);
+            return c1;
+        }
+        case PROD_EXP_PAREN:
+            return translateAccess(exp->children[1], base, displacement, type);
+        default: { // ID
+            Value* variable = lookupVariable(exp->children[0]->val);
+            Aggregate* aggregate = lookupAggregate(variable);
+            type = exp->type;
+            displacement = 0;
+            if (aggregate->param) { // already holds the address
+                base = variable;
+                return nullptr;
             }
-        } 
+            base = makePointer();
+            return new Code(IR_LOADADDR, variable, base);
+        }
     }
-    Value* addr = makePointer();
-    Value* offset = makePointer();
-    Array* arr = nullptr;
-    int depth = 0;
-    Code* c1 = translateArray(exp->children[0], addr, &arr, &depth);
-    if (ret_arr && ret_depth) {
-        *ret_arr = arr;
-        *ret_depth = depth + 1;
+}
+
+// the address of an array or struct variable, or of an element or member
+// inside one, into a value that must not be assigned to; type is set to
+// what is stored there
+Code* translateAddress(AST* exp, Value*& addr, const Type*& type) {
+    int displacement;
+    Code* c1 = translateAccess(exp, addr, displacement, type);
+    if (displacement == 0) {
+        return c1;
     }
-    Code* c2 = translateExp(exp->children[2], offset);
-    Code* c3 = new Code(IR_MUL, offset, makeCV(arr->sizes[depth]), offset);
-    Code* c4 = new Code(IR_ADD, addr, offset, addr);
-    Code* c5 = new Code(IR_MOVE, addr, temp);
-    return combineCode(combineCode(combineCode(combineCode(c1, c2), c3), c4), c5);
+    Value* base = addr;
+    addr = makePointer();
+    return combineCode(c1, new Code(IR_ADD, base, makeCV(displacement), addr));
 }
 
-Code* translateExp(AST* exp, Value* &temp) {
-    std::string repr = exp->to_string();
-    if (repr == "Exp_INT") {
-        return new Code(IR_MOVE, makeCV(exp->children[0]->val), temp);
-    } else if (repr == "Exp_ID") {
-        if (temp->type == VT_TEMP) {
-            temp = lookupVariable(exp->children[0]->str);
-            return nullptr;
+// copy size bytes between two addresses, a word at a time
+Code* translateCopy(Value* from, Value* to, int size) {
+    Code *head = nullptr, *tail = nullptr;
+    if (size <= COPY_UNROLL_WORDS * 4) {
+        for (int offset = 0; offset < size; offset += 4) {
+            Value *src = makePointer(), *dst = makePointer(), *word = makeTemp();
+            appendCode(head, tail, new Code(IR_ADD, from, makeCV(offset), src));
+            appendCode(head, tail, new Code(IR_ADD, to, makeCV(offset), dst));
+            appendCode(head, tail, new Code(IR_LOAD, src, word));
+            appendCode(head, tail, new Code(IR_STORE, word, dst));
         }
-        return new Code(IR_MOVE, lookupVariable(exp->children[0]->str), temp);
-    } else if (repr == "Exp_ExpASSIGNExp") {
-        Value* dest = lookupVariable(exp->children[0]);
-        if (dest->type == VT_COMPLEX) {
-            Value* addr = makePointer();
+        return head;
+    }
+    Value *offset = makePointer(), *src = makePointer(), *dst = makePointer(), *word = makeTemp();
+    Value *lb1 = makeLabel(), *lb2 = makeLabel();
+    appendCode(head, tail, new Code(IR_MOVE, makeCV(0), offset));
+    appendCode(head, tail, new Code(IR_LABEL, lb1));
+    appendCode(head, tail, new Code(IR_IFGOTO, offset, makeCV(size), lb2, IR_GE));
+    appendCode(head, tail, new Code(IR_ADD, from, offset, src));
+    appendCode(head, tail, new Code(IR_ADD, to, offset, dst));
+    appendCode(head, tail, new Code(IR_LOAD, src, word));
+    appendCode(head, tail, new Code(IR_STORE, word, dst));
+    appendCode(head, tail, new Code(IR_ADD, offset, makeCV(4), offset));
+    appendCode(head, tail, new Code(IR_GOTO, lb1));
+    appendCode(head, tail, new Code(IR_LABEL, lb2));
+    return head;
+}
+
+// assign a whole array or struct; both sides name one, as the checker
+// requires equivalent types
+Code* translateAggregateAssign(AST* to, AST* from, int size) {
+    Value *dst, *src;
+    const Type* type;
+    Code* c1 = translateAddress(to, dst, type);
+    Code* c2 = translateAddress(from, src, type);
+    return combineCode(combineCode(c1, c2), translateCopy(src, dst, size));
+}
+
+Code* translateExp(AST* exp, Value* &temp) {
+    IROpCode opcode;
+    switch (exp->prod) {
+        case PROD_EXP_INT:
+            return new Code(IR_MOVE, makeCV(exp->children[0]->val), temp);
+        case PROD_EXP_ID:
+            if (temp->type == VT_TEMP) {
+                temp = lookupVariable(exp->children[0]->val);
+                return nullptr;
+            }
+            return new Code(IR_MOVE, lookupVariable(exp->children[0]->val), temp);
+        case PROD_EXP_ASSIGN: {
+            if (const Type* type = aggregateType(exp->children[0])) {
+                return translateAggregateAssign(exp->children[0], exp->children[2], typeSize(type));
+            }
+            if (exp->children[0]->prod == PROD_EXP_ID) {
+                Value* dest = lookupVariable(exp->children[0]->children[0]->val);
+                return translateExp(exp->children[2], dest);
+            }
+            Value* addr;
             Value* val = makePointer();
-            Code* c1 = translateArray(exp->children[0], addr);
+            const Type* type;
+            Code* c1 = translateAddress(exp->children[0], addr, type);
             Code* c2 = translateExp(exp->children[2], val);
             Code* c3 = new Code(IR_STORE, val, addr);
             return combineCode(combineCode(c1, c2), c3);
         }
-        return translateExp(exp->children[2], dest);
-    } else if (exp->num_children == 3 && exp->children[0]->op == EXP && exp->children[2]->op == EXP) {
-        IROpCode opcode;
-        bool conditional = false;
-        switch (exp->children[1]->op) {
-            case AND_OP: opcode = IR_AND; conditional = true; break;
-            case OR_OP: opcode = IR_OR; conditional = true; break;
-            case LT_OP: opcode = IR_LT; conditional = true; break;
-            case LE_OP: opcode = IR_LE; conditional = true; break;
-            case GT_OP: opcode = IR_GT; conditional = true; break;
-            case GE_OP: opcode = IR_GE; conditional = true; break;
-            case NE_OP: opcode = IR_NE; conditional = true; break;
-            case EQ_OP: opcode = IR_EQ; conditional = true; break;
-            case PLUS_OP: opcode = IR_ADD; break;
-            case MINUS_OP: opcode = IR_MINUS; break;
-            case MUL_OP: opcode = IR_MUL; break;
-            case DIV_OP: opcode = IR_DIV; break;
-        }
-        if (conditional) {
+        case PROD_EXP_AND:
+        case PROD_EXP_OR:
+        case PROD_EXP_LT:
+        case PROD_EXP_LE:
+        case PROD_EXP_GT:
+        case PROD_EXP_GE:
+        case PROD_EXP_NE:
+        case PROD_EXP_EQ:
+        case PROD_EXP_NOT: {
             Value *lb1 = makeLabel(), *lb2 = makeLabel();
             Code* c1 = translateCondExp(exp, lb1, lb2);
             Code* c2 = new Code(IR_LABEL, lb1);
@@ -158,199 +290,215 @@ Code* translateExp(AST* exp, Value* &temp) {
             Code* c4 = new Code(IR_LABEL, lb2);
             Code* c5 = new Code(IR_MOVE, makeCV(0), temp);
             return combineCode(combineCode(combineCode(combineCode(c1, c2), c3), c4), c5);
-        } else {
-            Value *t1 = makeTemp(), *t2 = makeTemp();
-            Code* c1 = translateExp(exp->children[0], t1);
-            Code* c2 = translateExp(exp->children[2], t2);
-            Code* c3 = new Code(opcode, t1, t2, temp);
-            return combineCode(combineCode(c1, c2), c3);
-        }
-    } else if (repr == "Exp_MINUSExp") {
-        Code* c1 = translateExp(exp->children[1], temp);
-        Code* c2 = new Code(IR_MINUS, makeCV(0), temp, temp);
-        return combineCode(c1, c2);
-    } else if (repr == "Exp_NOTExp") {
-        Value *lb1 = makeLabel(), *lb2 = makeLabel();
-        Code* c1 = translateCondExp(exp, lb1, lb2);
-        Code* c2 = new Code(IR_LABEL, lb1);
-        Code* c3 = new Code(IR_MOVE, makeCV(1), temp);
-        Code* c4 = new Code(IR_LABEL, lb2);
-        Code* c5 = new Code(IR_MOVE, makeCV(0), temp);
-        return combineCode(combineCode(combineCode(combineCode(c1, c2), c3), c4), c5);
-    } else if (repr == "Exp_IDLPRP") {
-        if (!strcmp(exp->children[0]->str, "read")) {
-            return new Code(IR_READ, temp);
-        } else {
-            return new Code(IR_CALL, makeSV(exp->children[0]->str), temp);
         }
-    } else if (repr == "Exp_IDLPArgsRP") {
-        if (!strcmp(exp->children[0]->str, "write")) {
-            Code* c1 = translateExp(exp->children[2]->children[0], temp);
-            Code* c2 = new Code(IR_WRITE, temp);
+        case PROD_EXP_PLUS: opcode = IR_ADD; break;
+        case PROD_EXP_MINUS: opcode = IR_MINUS; break;
+        case PROD_EXP_MUL: opcode = IR_MUL; break;
+        case PROD_EXP_DIV: opcode = IR_DIV; break;
+        case PROD_EXP_NEG: {
+            Code* c1 = translateExp(exp->children[1], temp);
+            Code* c2 = new Code(IR_MINUS, makeCV(0), temp, temp);
             return combineCode(c1, c2);
-        } else {
-            std::vector<Value*> argList;
-            Code* c1 = translateArgs(exp->children[2], argList);
-            Code* c2 = nullptr;
-            for (int i = argList.size() - 1; i >= 0; i--) { // reversed arglist
-                if (symbol_array_table.find(argList[i]) != symbol_array_table.end()) {
-                    Value* addr = makePointer();
-                    c2 = combineCode(c2, new Code(IR_LOADADDR, argList[i], addr));
-                    c2 = combineCode(c2, new Code(IR_ARG, addr));
-                } else
-                c2 = combineCode(c2, new Code(IR_ARG, argList[i]));
+        }
+        case PROD_EXP_CALL_EMPTY:
+            if (exp->children[0]->val == ATOM_READ) {
+                return new Code(IR_READ, temp);
+            } else {
+                return new Code(IR_CALL, makeSV(strdup(atomName(exp->children[0]->val).c_str())), temp);
             }
-            Code* c3 = new Code(IR_CALL, makeSV(exp->children[0]->str), temp);
-            return combineCode(combineCode(c1, c2), c3);
+        case PROD_EXP_CALL:
+            if (exp->children[0]->val == ATOM_WRITE) {
+                Code* c1 = translateExp(exp->children[2]->children[0], temp);
+                Code* c2 = new Code(IR_WRITE, temp);
+                return combineCode(c1, c2);
+            } else {
+                std::vector<Value*> argList;
+                Code* c1 = translateArgs(exp->children[2], argList);
+                Code* c2 = nullptr;
+                for (int i = argList.size() - 1; i >= 0; i--) { // arrays and structs are passed by address
+                    Aggregate* aggregate = lookupAggregate(argList[i]);
+                    if (aggregate && !aggregate->param) {
+                        Value* addr = makePointer();
+                        c1 = combineCode(c1, new Code(IR_LOADADDR, argList[i], addr));
+                        argList[i] = addr;
+                    }
+                }
+                for (int i = argList.size() - 1; i >= 0; i--) { // reversed arglist, kept together for the inliner
+                    c2 = combineCode(c2, new Code(IR_ARG, argList[i]));
+                }
+                Code* c3 = new Code(IR_CALL, makeSV(strdup(atomName(exp->children[0]->val).c_str())), temp);
+                return combineCode(combineCode(c1, c2), c3);
+            }
+        case PROD_EXP_INDEX:
+        case PROD_EXP_MEMBER: {
+            Value* addr;
+            const Type* type;
+            Code* c1 = translateAddress(exp, addr, type);
+            if (type->kind != PRIMITIVE_TYPE) { // an inner array or struct is used by its address
+                if (temp->type == VT_TEMP) {
+                    temp = addr;
+                    return c1;
+                }
+                return combineCode(c1, new Code(IR_MOVE, addr, temp));
+            }
+            Code* c2 = new Code(IR_LOAD, addr, temp);
+            return combineCode(c1, c2);
         }
-    } else if (repr == "Exp_ExpLBExpRB") {
-        Value* addr = makePointer();
-        Code* c1 = translateArray(exp, addr);
-        Code* c2 = new Code(IR_LOAD, addr, temp);
-        return combineCode(c1, c2);
-    } else if (repr == "Exp_LPExpRP") {
-        return translateExp(exp->children[1], temp);
-    } else {
-        return nullptr;
+        case PROD_EXP_PAREN:
+            return translateExp(exp->children[1], temp);
+        default:
+            return nullptr;
     }
+    Value *t1 = makeTemp(), *t2 = makeTemp();
+    Code* c1 = translateExp(exp->children[0], t1);
+    Code* c2 = translateExp(exp->children[2], t2);
+    Code* c3 = new Code(opcode, t1, t2, temp);
+    return combineCode(combineCode(c1, c2), c3);
 }
 
 Code* translateArgs(AST* args, std::vector<Value*>& argList) {
-    if (args->num_children == 1) { // Exp
+    Code *head = nullptr, *tail = nullptr;
+    for (int i = 0; i < args->num_children; i++) {
         Value* t1 = makeTemp();
-        Code* c1 = translateExp(args->children[0], t1);
+        appendCode(head, tail, translateExp(args->children[i], t1));
         argList.push_back(t1);
-        return c1;
-    } else { // Exp COMMA Args
-        Value* t1 = makeTemp();
-        Code* c1 = translateExp(args->children[0], t1);
-        argList.push_back(t1);
-        Code* c2 = translateArgs(args->children[2], argList);
-        return combineCode(c1, c2);
     }
+    return head;
+}
+
+int varDecAtom(AST* varDec) {
+    while (varDec->num_children != 1) { // VarDec LB INT RB
+        varDec = varDec->children[0];
+    }
+    return varDec->children[0]->val;
 }
 
-Code* translateVarDec(AST* ast, bool param = false) {
-    Array* arr = makeArray(ast);
-    if (arr->dimensions.empty()) {
-        return nullptr; // not array, nop
+// names are reused across scopes, so a scalar must not keep the aggregate
+// entry of an earlier variable with its name
+void forgetAggregate(int atom) {
+    if (atom < symbol_table.size() && symbol_table[atom]) {
+        aggregate_table.erase(symbol_table[atom]);
     }
-    for (int i = 0; i < arr->dimensions.size(); i++) {
-        int size = 4;
-        for (int j = i + 1; j < arr->dimensions.size(); j++) {
-            size *= arr->dimensions[j];
+}
+
+Code* translateDec(AST* dec) {
+    const Type* type = dec->children[0]->type;
+    int atom = varDecAtom(dec->children[0]);
+    if (type->kind == PRIMITIVE_TYPE) {
+        forgetAggregate(atom);
+        if (dec->num_children == 3) { // VarDec ASSIGN Exp
+            Value* result = lookupVariable(atom);
+            return translateExp(dec->children[2], result);
         }
-        arr->sizes.push_back(size);
+        return nullptr;
     }
-    arr->param = param;
-    
-    Value* val = lookupVariable(arr->name);
-    array_table[arr->name] = arr;
-    symbol_array_table[val] = arr;
-    
+    Value* val = lookupVariable(atom);
+    aggregate_table[val] = { false };
     Code* c = new Code(IR_ALLOC, val);
-    c->size = 4;
-    for (int dimension : arr->dimensions) {
-        c->size *= dimension;
+    c->size = typeSize(type);
+    if (dec->num_children == 3) {
+        Value *src, *dst = makePointer();
+        const Type* from;
+        Code* c1 = new Code(IR_LOADADDR, val, dst);
+        Code* c2 = translateAddress(dec->children[2], src, from);
+        c = combineCode(combineCode(combineCode(c, c1), c2), translateCopy(src, dst, c->size));
     }
     return c;
 }
 
-Code* translateDec(AST* ast) {
-    if (ast->num_children == 3) { // VarDec ASSIGN Exp
-        Value* result = lookupVariable(ast->children[0]->children[0]->str);
-        Code* c1 = translateExp(ast->children[2], result);
-        return c1;
-    } else { // handle struct / array dec
-        return translateVarDec(ast->children[0]); // NOP
+Code* translateDef(AST* def) {
+    Code *head = nullptr, *tail = nullptr;
+    for (AST* decList = def->children[1]; decList; decList = decList->num_children == 3 ? decList->children[2] : nullptr) {
+        appendCode(head, tail, translateDec(decList->children[0]));
     }
+    return head;
 }
 
 Code* translateStmt(AST* stmt, Value* contLabel = nullptr, Value* breakLabel = nullptr) {
-    if (stmt->num_children == 1 || stmt->num_children == 2) {
-        std::string repr = stmt->to_string();
-        if (repr == "Stmt_CONTINUESEMI") {
+    switch (stmt->prod) {
+        case PROD_STMT_CONTINUE:
             return new Code(IR_GOTO, contLabel);
-        } else if (repr == "Stmt_BREAKSEMI") {
+        case PROD_STMT_BREAK:
             return new Code(IR_GOTO, breakLabel);
-        } else {
+        case PROD_STMT_EXP:
+        case PROD_STMT_COMPST:
             return translateCode(stmt->children[0], contLabel, breakLabel);
+        case PROD_STMT_RETURN: {
+            Value* t1 = makeTemp();
+            Code* c1 = translateExp(stmt->children[1], t1);
+            Code* c2 = new Code(IR_RETURN, t1);
+            return combineCode(c1, c2);
         }
-    } else if (stmt->children[0]->op == RETURN_SIGN) {
-        Value* t1 = makeTemp();
-        Code* c1 = translateExp(stmt->children[1], t1);
-        Code* c2 = new Code(IR_RETURN, t1);
-        return combineCode(c1, c2);
-    } else if (stmt->children[0]->op == IF_SIGN && stmt->num_children == 5) {
-        Value *lb1 = makeLabel(), *lb2 = makeLabel();
-        Code* c1 = translateCondExp(stmt->children[2], lb1, lb2);
-        Code* c2 = new Code(IR_LABEL, lb1);
-        Code* c3 = translateStmt(stmt->children[4], contLabel, breakLabel);
-        Code* c4 = new Code(IR_LABEL, lb2);
-        return combineCode(combineCode(combineCode(c1, c2), c3), c4);
-    } else if (stmt->children[0]->op == IF_SIGN && stmt->num_children == 7) {
-        Value *lb1 = makeLabel(), *lb2 = makeLabel(), *lb3 = makeLabel();
-        Code* c1 = translateCondExp(stmt->children[2], lb1, lb2);
-        Code* c2 = new Code(IR_LABEL, lb1);
-        Code* c3 = translateStmt(stmt->children[4], contLabel, breakLabel);
-        Code* c4 = new Code(IR_GOTO, lb3);
-        Code* c5 = new Code(IR_LABEL, lb2);
-        Code* c6 = translateStmt(stmt->children[6], contLabel, breakLabel);
-        Code* c7 = new Code(IR_LABEL, lb3);
-        return combineCode(combineCode(combineCode(combineCode(combineCode(combineCode(c1, c2), c3), c4), c5), c6), c7);
-    } else if (stmt->children[0]->op == DO_SIGN) { // DO Stmt WHILE LP Exp RP SEMI
-        Value *lb1 = makeLabel(), *lb2 = makeLabel(), *lb3 = makeLabel();
-        Code* c1 = new Code(IR_LABEL, lb1);
-        Code* c2 = translateStmt(stmt->children[1], lb2, lb3);
-        Code* c3 = new Code(IR_LABEL, lb2);
-        Code* c4 = translateCondExp(stmt->children[4], lb1, lb3);
-        Code* c5 = new Code(IR_GOTO, lb1);
-        Code* c6 = new Code(IR_LABEL, lb3);
-        return combineCode(combineCode(combineCode(combineCode(combineCode(c1, c2), c3), c4), c5), c6);
-    } else if (stmt->children[0]->op == WHILE_SIGN) {
-        Value *lb1 = makeLabel(), *lb2 = makeLabel(), *lb3 = makeLabel();
-        Code* c1 = new Code(IR_LABEL, lb1);
-        Code* c2 = translateCondExp(stmt->children[2], lb2, lb3);
-        Code* c3 = new Code(IR_LABEL, lb2);
-        Code* c4 = translateStmt(stmt->children[4], lb1, lb3);
-        Code* c5 = new Code(IR_GOTO, lb1);
-        Code* c6 = new Code(IR_LABEL, lb3);
-        return combineCode(combineCode(combineCode(combineCode(combineCode(c1, c2), c3), c4), c5), c6);
-    } else if (stmt->children[0]->op == FOR_SIGN) { // FOR LP Exp SEMI Exp SEMI Exp RP Stmt
-        Value *lb1 = makeLabel(), *lb2 = makeLabel(), *lb3 = makeLabel();
-        Code* c0_0 = translateCode(stmt->children[2], contLabel, breakLabel);
-        Code* c0_1 = translateCode(stmt->children[6], contLabel, breakLabel);
-        Code* c1 = combineCode(c0_0, new Code(IR_LABEL, lb1));
-        Code* c2 = stmt->children[4]->op != NOP_SIGN ? translateCondExp(stmt->children[4], lb2, lb3) : nullptr;
-        Code* c3 = new Code(IR_LABEL, lb2);
-        Code* c4 = combineCode(translateStmt(stmt->children[8], lb1, lb3), c0_1);
-        Code* c5 = new Code(IR_GOTO, lb1);
-        Code* c6 = new Code(IR_LABEL, lb3);
-        return combineCode(combineCode(combineCode(combineCode(combineCode(c1, c2), c3), c4), c5), c6);
+        case PROD_STMT_IF: {
+            Value *lb1 = makeLabel(), *lb2 = makeLabel();
+            Code* c1 = translateCondExp(stmt->children[2], lb1, lb2);
+            Code* c2 = new Code(IR_LABEL, lb1);
+            Code* c3 = translateStmt(stmt->children[4], contLabel, breakLabel);
+            Code* c4 = new Code(IR_LABEL, lb2);
+            return combineCode(combineCode(combineCode(c1, c2), c3), c4);
+        }
+        case PROD_STMT_IFELSE: {
+            Value *lb1 = makeLabel(), *lb2 = makeLabel(), *lb3 = makeLabel();
+            Code* c1 = translateCondExp(stmt->children[2], lb1, lb2);
+            Code* c2 = new Code(IR_LABEL, lb1);
+            Code* c3 = translateStmt(stmt->children[4], contLabel, breakLabel);
+            Code* c4 = new Code(IR_GOTO, lb3);
+            Code* c5 = new Code(IR_LABEL, lb2);
+            Code* c6 = translateStmt(stmt->children[6], contLabel, breakLabel);
+            Code* c7 = new Code(IR_LABEL, lb3);
+            return combineCode(combineCode(combineCode(combineCode(combineCode(combineCode(c1, c2), c3), c4), c5), c6), c7);
+        }
+        case PROD_STMT_DO: { // DO Stmt WHILE LP Exp RP SEMI
+            Value *lb1 = makeLabel(), *lb2 = makeLabel(), *lb3 = makeLabel();
+            Code* c1 = new Code(IR_LABEL, lb1);
+            Code* c2 = translateStmt(stmt->children[1], lb2, lb3);
+            Code* c3 = new Code(IR_LABEL, lb2);
+            Code* c4 = translateCondExp(stmt->children[4], lb1, lb3);
+            Code* c5 = new Code(IR_GOTO, lb1);
+            Code* c6 = new Code(IR_LABEL, lb3);
+            return combineCode(combineCode(combineCode(combineCode(combineCode(c1, c2), c3), c4), c5), c6);
+        }
+        case PROD_STMT_WHILE: {
+            Value *lb1 = makeLabel(), *lb2 = makeLabel(), *lb3 = makeLabel();
+            Code* c1 = new Code(IR_LABEL, lb1);
+            Code* c2 = translateCondExp(stmt->children[2], lb2, lb3);
+            Code* c3 = new Code(IR_LABEL, lb2);
+            Code* c4 = translateStmt(stmt->children[4], lb1, lb3);
+            Code* c5 = new Code(IR_GOTO, lb1);
+            Code* c6 = new Code(IR_LABEL, lb3);
+            return combineCode(combineCode(combineCode(combineCode(combineCode(c1, c2), c3), c4), c5), c6);
+        }
+        case PROD_STMT_FOR: { // FOR LP Exp SEMI Exp SEMI Exp RP Stmt
+            Value *lb1 = makeLabel(), *lb2 = makeLabel(), *lb3 = makeLabel();
+            Code* c0_0 = translateCode(stmt->children[2], contLabel, breakLabel);
+            Code* c0_1 = translateCode(stmt->children[6], contLabel, breakLabel);
+            Code* c1 = combineCode(c0_0, new Code(IR_LABEL, lb1));
+            Code* c2 = stmt->children[4]->op != NOP_SIGN ? translateCondExp(stmt->children[4], lb2, lb3) : nullptr;
+            Code* c3 = new Code(IR_LABEL, lb2);
+            Code* c4 = combineCode(translateStmt(stmt->children[8], lb1, lb3), c0_1);
+            Code* c5 = new Code(IR_GOTO, lb1);
+            Code* c6 = new Code(IR_LABEL, lb3);
+            return combineCode(combineCode(combineCode(combineCode(combineCode(c1, c2), c3), c4), c5), c6);
+        }
+        default:
+            return nullptr; // unreachable
     }
-    return nullptr; // unreachable
 }
 
-Value* findArrayValue(AST* ast) {
-    AST* arr = ast;
-    bool isArray = false;
-    while (ast->children[0]->op != SYMBOL) {
-        ast = ast->children[0];
-        isArray = true;
-    }
-    if (isArray) {
-        translateVarDec(arr, true);
+Value* translateParamDec(AST* paramDec) {
+    const Type* type = paramDec->children[1]->type;
+    int atom = varDecAtom(paramDec->children[1]);
+    forgetAggregate(atom);
+    Value* val = lookupVariable(atom);
+    if (type->kind != PRIMITIVE_TYPE) {
+        aggregate_table[val] = { true };
     }
-    return lookupVariable(ast->children[0]->str);
+    return val;
 }
 
 Code* translateVarList(AST* varList, std::vector<Value*>& argList) {
-    if (varList->num_children == 1) {
-        Value* arg = findArrayValue(varList->children[0]->children[1]);
-        argList.push_back(arg);
-    } else {
-        Value* arg = findArrayValue(varList->children[0]->children[1]);
-        argList.push_back(arg);
+    argList.push_back(translateParamDec(varList->children[0]));
+    if (varList->num_children == 3) { // ParamDec COMMA VarList
         translateVarList(varList->children[2], argList);
     }
     return nullptr; // ALWAYS NOP
@@ -358,9 +506,9 @@ Code* translateVarList(AST* varList, std::vector<Value*>& argList) {
 
 Code* translateFunDec(AST* funDec) {
     if (funDec->num_children == 3) {
-        return new Code(IR_FUNDEC, makeSV(funDec->children[0]->str));
+        return new Code(IR_FUNDEC, makeSV(strdup(atomName(funDec->children[0]->val).c_str())));
     } else {
-        Code* c1 = new Code(IR_FUNDEC, makeSV(funDec->children[0]->str));
+        Code* c1 = new Code(IR_FUNDEC, makeSV(strdup(atomName(funDec->children[0]->val).c_str())));
         std::vector<Value*> argList;
         translateVarList(funDec->children[2], argList);
         Code* c2 = nullptr;
@@ -382,16 +530,18 @@ Code* translateCode(AST* ast, Value* contLabel, Value* breakLabel) {
             return translateExp(ast, t1);
         case FUNDEC:
             return translateFunDec(ast);
-        case DEC:
-            return translateDec(ast);
+        case DEF:
+            return translateDef(ast);
+        case SPECIFIER: // struct definitions only give types
+            return nullptr;
         case STMT:
             return translateStmt(ast, contLabel, breakLabel);
         default:
-            Code* code = nullptr;
+            Code *head = nullptr, *tail = nullptr;
             for (int i = 0; i < ast->num_children; i++) {
-                code = combineCode(code, translateCode(ast->children[i], contLabel, breakLabel));
+                appendCode(head, tail, translateCode(ast->children[i], contLabel, breakLabel));
             }
-            return code;
+            return head;
     }
 }
 
@@ -407,6 +557,10 @@ const char* ircode_to_string(IROpCode opcode) {
         case IR_MINUS: return "-";
         case IR_MUL: return "*";
         case IR_DIV: return "/";
+        case IR_VADD: return "VADD";
+        case IR_VMINUS: return "VMINUS";
+        case IR_VMUL: return "VMUL";
+        case IR_VSTEP: return "VSTEP";
         default: return "?";
     }
 }
@@ -420,64 +574,83 @@ void irFixPrev(Code* head) {
     }
 }
 
-void irPrint(Code* head) {
+void irPrint(Code* head, FILE* out = stdout) {
     while (head) {
         switch (head->opcode) {
             case IR_MOVE:
-                printf("%s := %s\n", head->result->to_chararray(), head->arg1->to_chararray());
+                fprintf(out, "%s := %s\n", head->result->to_string().c_str(), head->arg1->to_string().c_str());
                 break;
             case IR_LOADADDR:
-                printf("%s := &%s\n", head->result->to_chararray(), head->arg1->to_chararray());
+                fprintf(out, "%s := &%s\n", head->result->to_string().c_str(), head->arg1->to_string().c_str());
                 break;
             case IR_LOAD:
-                printf("%s := *%s\n", head->result->to_chararray(), head->arg1->to_chararray());
+                fprintf(out, "%s := *%s\n", head->result->to_string().c_str(), head->arg1->to_string().c_str());
                 break;
             case IR_STORE:
-                printf("*%s := %s\n", head->result->to_chararray(), head->arg1->to_chararray());
+                fprintf(out, "*%s := %s\n", head->result->to_string().c_str(), head->arg1->to_string().c_str());
                 break;
             case IR_ADD:
             case IR_MINUS:
             case IR_MUL:
             case IR_DIV:
-                printf("%s := %s %s %s\n", head->result->to_chararray(), head->arg1->to_chararray(),
-                                           ircode_to_string(head->opcode), head->arg2->to_chararray());
+                fprintf(out, "%s := %s %s %s\n", head->result->to_string().c_str(), head->arg1->to_string().c_str(),
+                                           ircode_to_string(head->opcode), head->arg2->to_string().c_str());
                 break;
             case IR_FUNDEC:
-                printf("FUNCTION %s :\n", head->result->to_chararray());
+                fprintf(out, "FUNCTION %s :\n", head->result->to_string().c_str());
                 break;
             case IR_LABEL:
-                printf("LABEL %s :\n", head->result->to_chararray());
+                fprintf(out, "LABEL %s :\n", head->result->to_string().c_str());
                 break;
             case IR_IFGOTO:
-                printf("IF %s %s %s GOTO %s\n", head->arg1->to_chararray(), ircode_to_string(head->relop), 
-                                                head->arg2->to_chararray(), head->result->to_chararray());
+                fprintf(out, "IF %s %s %s GOTO %s\n", head->arg1->to_string().c_str(), ircode_to_string(head->relop), 
+                                                head->arg2->to_string().c_str(), head->result->to_string().c_str());
                 break;
             case IR_GOTO:
-                printf("GOTO %s\n", head->result->to_chararray());
+                fprintf(out, "GOTO %s\n", head->result->to_string().c_str());
                 break;
             case IR_READ:
-                printf("READ %s\n", head->result->to_chararray());
+                fprintf(out, "READ %s\n", head->result->to_string().c_str());
                 break;
             case IR_WRITE:
-                printf("WRITE %s\n", head->result->to_chararray());
+                fprintf(out, "WRITE %s\n", head->result->to_string().c_str());
                 break;
             case IR_CALL:
-                printf("%s := CALL %s\n", head->result->to_chararray(), head->arg1->to_chararray());
+                fprintf(out, "%s := CALL %s\n", head->result->to_string().c_str(), head->arg1->to_string().c_str());
                 break;
             case IR_RETURN:
-                printf("RETURN %s\n", head->result->to_chararray());
+                fprintf(out, "RETURN %s\n", head->result->to_string().c_str());
                 break;
             case IR_ARG:
-                printf("ARG %s\n", head->result->to_chararray());
+                fprintf(out, "ARG %s\n", head->result->to_string().c_str());
                 break;
             case IR_PARAM:
-                printf("PARAM %s\n", head->result->to_chararray());
+                fprintf(out, "PARAM %s\n", head->result->to_string().c_str());
                 break;
             case IR_ALLOC:
-                printf("DEC %s %d\n", head->result->to_chararray(), head->size);
+                fprintf(out, "DEC %s %d\n", head->result->to_string().c_str(), head->size);
+                break;
+            case IR_VLOAD:
+                fprintf(out, "%s := VLOAD *%s, %d\n", head->result->to_string().c_str(), head->arg1->to_string().c_str(), head->size);
+                break;
+            case IR_VSTORE:
+                fprintf(out, "VSTORE *%s, %s, %d\n", head->result->to_string().c_str(), head->arg1->to_string().c_str(), head->size);
+                break;
+            case IR_VADD:
+            case IR_VMINUS:
+            case IR_VMUL:
+            case IR_VSTEP:
+                fprintf(out, "%s := %s %s, %s, %d\n", head->result->to_string().c_str(), ircode_to_string(head->opcode),
+                                               head->arg1->to_string().c_str(), head->arg2->to_string().c_str(), head->size);
+                break;
+            case IR_FILL:
+                fprintf(out, "FILL *%s, %s, %s\n", head->result->to_string().c_str(), head->arg1->to_string().c_str(), head->arg2->to_string().c_str());
+                break;
+            case IR_COPY:
+                fprintf(out, "COPY *%s, *%s, %s\n", head->result->to_string().c_str(), head->arg1->to_string().c_str(), head->arg2->to_string().c_str());
                 break;
             default:
-                printf("%s\n", head->to_chararray());
+                fprintf(out, "%s\n", head->to_string().c_str());
         }
         head = head->next;
     }
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ast.h"
+#include "ir.hpp"
+#include "ir_alias.hpp"
+#include "ir_cfg.hpp"
+#include "ir_codegen.hpp"
+#include "ir_optimizer.hpp"
+#include "ir_vectorize.hpp"
+
+// the constant the straight-line code before pos last moved into iv, if any
+Value* irIdiomKnownValue(Code* pos, Value* iv) {
+    for (Code* code = pos->prev; code && code->opcode != IR_LABEL && code->opcode != IR_FUNDEC && !irIsTerminator(code->opcode); code = code->prev) {
+        if (irDefinesResult(code->opcode) && code->result == iv) {
+            return code->opcode == IR_MOVE && isConstant(code->arg1) ? code->arg1 : nullptr;
+        }
+    }
+    return nullptr;
+}
+
+// whether the loop runs at least once whenever its head is fallen into,
+// because a guard skips it otherwise or iv and bound are known constants
+bool irIdiomGuarded(IRVectorLoop& loop) {
+    Code* guard = loop.head->prev;
+    if (guard->opcode == IR_GOTO || guard->opcode == IR_RETURN) {
+        return true;
+    }
+    if (guard->opcode == IR_IFGOTO && guard->relop == rev_relop(loop.relop) && guard->arg2 == loop.bound) {
+        Value* known = irIdiomKnownValue(guard, loop.iv);
+        return guard->arg1 == loop.iv || (known && guard->arg1 == known);
+    }
+    Value* known = irIdiomKnownValue(loop.head, loop.iv);
+    return known && isConstant(loop.bound) && irCompare(loop.relop, known->val, loop.bound->val);
+}
+
+// a body that only stores, one word further each iteration, either the
+// same value or a word loaded one word further each iteration, becomes
+// one FILL or COPY of bytes per store, after the address computations.
+// A COPY reads its source where the store was, so no store may write the
+// source array between the load and that store
+bool irIdiomBody(IRVectorState& state, Value* bytes) {
+    std::unordered_map<Value*, std::pair<Value*, int>> loads; // values loaded each iteration: address, stores before the load
+    std::vector<Value*> stored; // arrays written, in order
+    for (Code* code = state.loop.head->next; code != state.loop.step; code = code->next) {
+        Value* result = code->result;
+        switch (code->opcode) {
+            case IR_LOADADDR:
+                if (!state.arrays.count(code->arg1)) {
+                    return false;
+                }
+                state.scalars[result].base = code->arg1;
+                break;
+            case IR_MOVE: {
+                auto load = loads.find(code->arg1);
+                if (load != loads.end()) {
+                    std::pair<Value*, int> loaded = load->second;
+                    loads[result] = loaded;
+                    continue;
+                }
+                state.scalars[result] = irAffineOf(state, code->arg1);
+                break;
+            }
+            case IR_ADD:
+            case IR_MINUS:
+            case IR_MUL:
+                if (loads.count(code->arg1) || loads.count(code->arg2) || !irAffineAssign(state, code)) {
+                    return false;
+                }
+                break;
+            case IR_LOAD:
+                if (loads.count(code->arg1) || !irVectorAddress(state, code->arg1, true, false)) {
+                    return false;
+                }
+                if (!state.accesses.back().first.stride) {
+                    state.scalars[result].terms[result] = 1;
+                    break;
+                }
+                loads[result] = { code->arg1, (int)stored.size() };
+                continue;
+            case IR_STORE: {
+                if (loads.count(result) || !irVectorAddress(state, result, false, true)) {
+                    return false;
+                }
+                auto load = loads.find(code->arg1);
+                if (load != loads.end()) {
+                    Value* source = irAffineOf(state, load->second.first).base;
+                    if (std::find(stored.begin() + load->second.second, stored.end(), source) != stored.end()) {
+                        return false;
+                    }
+                    irVectorEmit(state, new Code(IR_COPY, load->second.first, bytes, result));
+                } else if (!irAffineOf(state, code->arg1).stride) {
+                    irVectorEmit(state, new Code(IR_FILL, code->arg1, bytes, result));
+                } else {
+                    return false;
+                }
+                stored.push_back(state.accesses.back().first.base);
+                continue;
+            }
+            default:
+                return false;
+        }
+        irVectorEmit(state, new Code(code->opcode, code->arg1, code->arg2, result));
+    }
+    return irVectorIndependent(state);
+}
+
+// replace the loop by the bulk operations, for as many words as it has
+// iterations left, and leave iv where the loop would:
+//     [LABEL cond :  IF iv >= bound GOTO done]
+//     bytes := bound - iv;  bytes := bytes * #4
+//     address computations  FILL/COPY ... bytes
+//     iv := bound
+//     [LABEL done :]
+void irIdiomLoop(IRVectorState& state, Value* bytes) {
+    IRVectorLoop& loop = state.loop;
+    Code *head = nullptr, *tail = nullptr;
+    Value* done = nullptr;
+    if (loop.cond) {
+        done = makeLabel();
+        irUnlink(loop.cond);
+        loop.cond->next = nullptr;
+        appendCode(head, tail, loop.cond);
+        appendCode(head, tail, new Code(IR_IFGOTO, loop.iv, loop.bound, done, rev_relop(loop.relop)));
+    }
+    appendCode(head, tail, new Code(IR_MINUS, loop.bound, loop.iv, bytes));
+    if (loop.relop == IR_LE) {
+        appendCode(head, tail, new Code(IR_ADD, bytes, makeCV(1), bytes));
+    }
+    appendCode(head, tail, new Code(IR_MUL, bytes, makeCV(4), bytes));
+    appendCode(head, tail, state.head);
+    if (loop.relop == IR_LE) {
+        appendCode(head, tail, new Code(IR_ADD, loop.bound, makeCV(1), loop.iv));
+    } else {
+        appendCode(head, tail, new Code(IR_MOVE, loop.bound, loop.iv));
+    }
+    if (done) {
+        appendCode(head, tail, new Code(IR_LABEL, done));
+    }
+    state.head = state.tail = nullptr;
+
+    Code* pos = loop.head->prev;
+    std::vector<Code*> removed;
+    for (Code* code = loop.head; code != loop.branch->next; code = code->next) {
+        removed.push_back(code);
+    }
+    for (Code* code : removed) {
+        disableInst(code);
+    }
+    tail->next = pos->next;
+    if (pos->next) {
+        pos->next->prev = tail;
+    }
+    head->prev = pos;
+    pos->next = head;
+}
+
+void irIdiomFunction(Code* fundec) {
+    IRVectorState state;
+    irVectorScan(state, fundec);
+    for (Code* branch : state.branches) {
+        if (!irMatchVectorLoop(state, branch) || !irIdiomGuarded(state.loop)) {
+            continue;
+        }
+        Value* bytes = makeTemp();
+        if (irVectorValuesLocal(state) && irIdiomBody(state, bytes)) {
+            irIdiomLoop(state, bytes);
+        }
+    }
+    irVectorReset(state);
+}
+
+// loop idiom recognition: SPL has no memset or memcpy, so arrays are
+// filled and copied by loops of several instructions per word; each such
+// loop over DEC'd arrays becomes one FILL or COPY per array it writes.
+// Like vector operations these are unknown to the course simulator, so
+// this runs on request only, after the other passes
+void irIdiomOpt(Code* code) {
+    irFixPrev(code);
+    for (Code* fundec : irFindFunctionHeads(code)) {
+        irIdiomFunction(fundec);
+    }
+}
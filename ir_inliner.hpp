@@ -2,22 +2,50 @@
 
 #include <algorithm>
 #include <unordered_map>
+#include <unordered_set>
 #include <string>
 #include <vector>
 
 #include "ast.h"
 #include "ir.hpp"
 #include "ir_optimizer.hpp"
+#include "ir_profile.hpp"
 
 #define ENABLE_INLINE 100
 
+#define INLINE_CALLEE_LIMIT 64 // callees above this size are only inlined at their only call site
+
+#define INLINE_THRESHOLD 12 // net instruction growth allowed per call site
+
+#define INLINE_BUDGET_PERCENT 100 // total growth allowed relative to the program size
+
 struct IRFunction {
+    Code* fundec;
+
     Code* entry;
-    
+
     std::vector<Value*> params;
+
+    int size = 0;
+
+    int calls = 0; // call sites referencing this function
+
+    bool recursive = false;
 };
 
-std::unordered_map<std::string, IRFunction*> functions;
+thread_local std::unordered_map<std::string, IRFunction*> functions;
+
+struct InlineSite {
+    IRFunction* caller;
+
+    IRFunction* callee;
+
+    Code* call;
+
+    std::vector<Code*> args; // in ARG order, i.e. last parameter first
+
+    int growth;
+};
 
 std::vector<Value*> irFindParams(Code* code) {
     std::vector<Value*> params;
@@ -28,109 +56,276 @@ std::vector<Value*> irFindParams(Code* code) {
     return params;
 }
 
+IRFunction* irMakeFunction(Code* fundec) {
+    IRFunction* function = new IRFunction();
+    Code* entry = fundec->next;
+    while (entry && entry->opcode == IR_PARAM) {
+        entry = entry->next;
+    }
+    function->fundec = fundec;
+    function->entry = entry;
+    function->params = irFindParams(fundec->next);
+    for (Code* code = entry; code && code->opcode != IR_FUNDEC; code = code->next) {
+        if (code->opcode != IR_LABEL && code->opcode != IR_PARAM) {
+            function->size++;
+        }
+    }
+    return function;
+}
+
 void irFindAllFunctions(Code* code) {
-    while (code) {
+    for (auto& iter : functions) {
+        delete iter.second;
+    }
+    functions.clear();
+    for (; code; code = code->next) {
         if (code->opcode == IR_FUNDEC) {
-            IRFunction* function = new IRFunction();
-            Code* entry = code->next;
-            while (entry && entry->opcode == IR_PARAM) {
-                entry = entry->next;
+            functions[code->result->to_string()] = irMakeFunction(code);
+        }
+    }
+    for (auto& iter : functions) {
+        for (Code* code = iter.second->entry; code && code->opcode != IR_FUNDEC; code = code->next) {
+            if (code->opcode == IR_CALL) {
+                auto callee = functions.find(code->arg1->to_string());
+                if (callee != functions.end()) {
+                    callee->second->calls++;
+                    callee->second->recursive |= callee->second == iter.second;
+                }
             }
-            function->entry = entry;
-            function->params = irFindParams(code->next);
-            functions[code->result->to_string()] = function;
         }
-        code = code->next;
     }
 }
 
 bool irCanInline(IRFunction* function) {
-    Code* code = function->entry;
-    while (code && code->opcode != IR_FUNDEC) {
-        if (code->opcode == IR_CALL || code->opcode == IR_LOAD || std::find(function->params.begin(), function->params.end(), code->result) != function->params.end()) {
-            return false;
+    return !function->recursive && function->fundec->result->to_string() != "main";
+}
+
+// callee size plus parameter copies, minus the ARG/CALL/PARAM/RETURN overhead
+// that disappears and the folding each constant argument enables
+int irInlineGrowth(IRFunction* callee, const std::vector<Code*>& args) {
+    int growth = callee->size + callee->params.size();
+    int benefit = 2 * args.size() + 2;
+    for (Code* arg : args) {
+        if (isConstant(arg->result)) {
+            benefit += 2;
         }
-        code = code->next;
     }
-    return true;
+    return growth - benefit;
 }
 
-Code* irCopyCode(Code* code, std::unordered_map<Value*, Value*>& args, Value* ret) {
-    Code* nCode = new Code(code->opcode, code->arg1, code->arg2, code->result, code->relop);
-    nCode->size = code->size;
-    
-    std::vector<Value**> vec { &nCode->arg1, &nCode->arg2, &nCode->result };
-    for (Value** val : vec) {
-        if (*val) {
-            auto iter = args.find(*val);
-            if (iter != args.end()) {
-                *val = iter->second;
+bool irWritesValue(IRFunction* function, Value* value) {
+    for (Code* code = function->entry; code && code->opcode != IR_FUNDEC; code = code->next) {
+        if (irIsAssign(code->opcode) || code->opcode == IR_READ) {
+            if (code->result == value) {
+                return true;
             }
         }
     }
-    
-    if (nCode->opcode == IR_RETURN) {
-        nCode->opcode = IR_MOVE;
-        nCode->arg1 = code->result;
-        nCode->result = ret;
+    return false;
+}
+
+Value* irRemapValue(Value* value, std::unordered_map<Value*, Value*>& remapping) {
+    if (!value) return nullptr;
+    auto iter = remapping.find(value);
+    if (iter != remapping.end()) {
+        return iter->second;
+    }
+    switch (value->type) {
+        case VT_VAR:
+        case VT_TEMP:
+            return remapping[value] = makeTemp();
+        case VT_POINTER:
+            return remapping[value] = makePointer();
+        case VT_LABEL:
+            return remapping[value] = makeLabel();
+        default:
+            return value;
     }
-    
+}
+
+Code* irCopyCode(Code* code, std::unordered_map<Value*, Value*>& remapping) {
+    Code* nCode = new Code(code->opcode, code->arg1, code->arg2, code->result, code->relop);
+    nCode->size = code->size;
+    nCode->hits = code->hits;
+
+    nCode->arg1 = irRemapValue(nCode->arg1, remapping);
+    nCode->arg2 = irRemapValue(nCode->arg2, remapping);
+    nCode->result = irRemapValue(nCode->result, remapping);
+
     return nCode;
 }
 
-void irInsertFunction(Code* code, std::unordered_map<Value*, Value*>& args, Value* ret, IRFunction* function) {
-    Code* prev = code;
-    Code* insert = function->entry;
-    
-    while (insert && insert->opcode != IR_FUNDEC) {
-        if (insert->opcode == IR_LABEL || insert->opcode == IR_IFGOTO || insert->opcode == IR_GOTO) {
-            Value* oldLabel = insert->result;
-            if (args.find(oldLabel) == args.end()) {
-                args[oldLabel] = makeLabel();
+// copy the callee body after the call; locals and labels are renamed per copy,
+// written parameters get a private copy, every RETURN moves its value into the
+// call result and jumps to a continuation label, and ALLOCs go to the caller entry
+void irInsertFunction(InlineSite& site) {
+    IRFunction* callee = site.callee;
+    std::unordered_map<Value*, Value*> remapping;
+    Code* pos = site.call;
+    for (int i = 0; i < callee->params.size(); i++) {
+        Value* arg = site.args[site.args.size() - i - 1]->result;
+        Value* param = callee->params[i];
+        if (irWritesValue(callee, param)) {
+            remapping[param] = param->type == VT_POINTER ? makePointer() : makeTemp();
+            pos = irInsertAfter(pos, new Code(IR_MOVE, arg, remapping[param]));
+        } else {
+            remapping[param] = arg;
+        }
+    }
+
+    Code* allocPos = site.caller->entry ? site.caller->entry->prev : site.caller->fundec;
+    Value* ret = site.call->result;
+    Value* cont = makeLabel();
+    bool jumped = false;
+    for (Code* insert = callee->entry; insert && insert->opcode != IR_FUNDEC; insert = insert->next) {
+        Code* copy = irCopyCode(insert, remapping);
+        if (copy->opcode == IR_ALLOC) {
+            allocPos = irInsertAfter(allocPos, copy);
+        } else if (copy->opcode == IR_RETURN) {
+            copy->opcode = IR_MOVE;
+            copy->arg1 = copy->result;
+            copy->result = ret;
+            pos = irInsertAfter(pos, copy);
+            if (insert->next && insert->next->opcode != IR_FUNDEC) {
+                pos = irInsertAfter(pos, new Code(IR_GOTO, cont));
+                jumped = true;
             }
+        } else {
+            pos = irInsertAfter(pos, copy);
         }
-        
-        Code* copy = irCopyCode(insert, args, ret);
-        Code* prevNext = prev->next;
-        prev->next = copy;
-        copy->next = prevNext;
-        prev = copy;
-        
-        insert = insert->next;
     }
+    if (jumped) {
+        irInsertAfter(pos, new Code(IR_LABEL, cont));
+    }
+
+    for (Code* arg : site.args) {
+        disableInst(arg);
+    }
+    disableInst(site.call);
 }
 
-void irInlineFunction(IRFunction* function) {
+std::vector<InlineSite> irFindInlineSites(IRFunction* caller) {
+    std::vector<InlineSite> sites;
     std::vector<Code*> args;
-    Code* code = function->entry;
-    while (code && code->opcode != IR_FUNDEC) {
+    for (Code* code = caller->entry; code && code->opcode != IR_FUNDEC; code = code->next) {
         if (code->opcode == IR_ARG) {
             args.push_back(code);
         } else if (code->opcode == IR_CALL) {
-            IRFunction* callee = functions[code->arg1->to_string()];
-            if (callee != function && irCanInline(callee)) {
-                std::unordered_map<Value*, Value*> remapping;
-                for (int i = 0; i < args.size(); i++) {
-                    remapping[callee->params[i]] = args[args.size() - i - 1]->result;
-                }
-                irInsertFunction(code, remapping, code->result, callee);
-                for (int i = 0; i < args.size(); i++) {
-                    disableInst(args[i]);
+            auto iter = functions.find(code->arg1->to_string());
+            IRFunction* callee = iter == functions.end() ? nullptr : iter->second;
+            if (callee && callee != caller && callee->params.size() == args.size() && irIsHotCall(code) && irCanInline(callee)) {
+                int growth = irInlineGrowth(callee, args);
+                bool onlySite = callee->calls == 1;
+                if (onlySite || (callee->size <= INLINE_CALLEE_LIMIT && growth <= INLINE_THRESHOLD)) {
+                    sites.push_back({ caller, callee, code, args, onlySite ? -callee->size : growth });
                 }
-                disableInst(code);
             }
             args.clear();
+        } else if (code->opcode != IR_LABEL) {
+            args.clear();
         }
-        code = code->next;
     }
+    return sites;
 }
 
-void irInline(Code* code) {
+// drop functions no longer reachable from main through calls
+Code* irRemoveDeadFunctions(Code* code) {
+    auto main = functions.find("main");
+    if (main == functions.end()) return code;
+    std::unordered_set<IRFunction*> live { main->second };
+    std::vector<IRFunction*> worklist { main->second };
+    while (!worklist.empty()) {
+        IRFunction* function = worklist.back();
+        worklist.pop_back();
+        for (Code* code = function->entry; code && code->opcode != IR_FUNDEC; code = code->next) {
+            if (code->opcode != IR_CALL) continue;
+            auto iter = functions.find(code->arg1->to_string());
+            if (iter != functions.end() && live.insert(iter->second).second) {
+                worklist.push_back(iter->second);
+            }
+        }
+    }
+    for (auto& iter : functions) {
+        Code* fundec = iter.second->fundec;
+        if (live.count(iter.second)) continue;
+        Code* end = fundec->next;
+        while (end && end->opcode != IR_FUNDEC) {
+            end = end->next;
+        }
+        if (fundec->prev) {
+            fundec->prev->next = end;
+        } else {
+            code = end;
+        }
+        if (end) {
+            end->prev = fundec->prev;
+        }
+        for (Code* dead = fundec; dead != end; dead = dead->next) {
+            irRetireCode(dead);
+        }
+    }
+    return code;
+}
+
+Code* irInline(Code* code) {
+    irFixPrev(code);
     irFindAllFunctions(code);
+    int budget = 32;
+    for (auto& iter : functions) {
+        budget += iter.second->size * INLINE_BUDGET_PERCENT / 100;
+    }
     for (int i = 0; i < ENABLE_INLINE; i++) {
+        std::vector<InlineSite> sites;
         for (auto& iter : functions) {
-            irFixPrev(code);
-            irInlineFunction(iter.second);
+            auto found = irFindInlineSites(iter.second);
+            sites.insert(sites.end(), found.begin(), found.end());
+        }
+        // hottest sites first, then the cheapest
+        std::stable_sort(sites.begin(), sites.end(), [](const InlineSite& a, const InlineSite& b) {
+            return a.call->hits != b.call->hits ? a.call->hits > b.call->hits : a.growth < b.growth;
+        });
+
+        // a function changed in this round is not copied until the next one
+        std::unordered_set<IRFunction*> changed;
+        for (InlineSite& site : sites) {
+            if (changed.count(site.callee) || site.growth > budget) continue;
+            irInsertFunction(site);
+            changed.insert(site.caller);
+            budget -= std::max(site.growth, 0);
+        }
+        irFixPrev(code);
+        irFindAllFunctions(code);
+        if (changed.empty()) {
+            break;
+        }
+    }
+    return irRemoveDeadFunctions(code);
+}
+
+// streamed compilation: inline into one function the bodies kept in
+// `functions` from those already emitted. A call can only reach an earlier
+// function or recurse, so no later definition could change a decision
+void irInlineStreamed(Code* fundec) {
+    IRFunction* caller = irMakeFunction(fundec);
+    int budget = 32 + caller->size * INLINE_BUDGET_PERCENT / 100;
+    for (int i = 0; i < ENABLE_INLINE; i++) {
+        std::vector<InlineSite> sites = irFindInlineSites(caller);
+        std::stable_sort(sites.begin(), sites.end(), [](const InlineSite& a, const InlineSite& b) {
+            return a.growth < b.growth;
+        });
+        bool changed = false;
+        for (InlineSite& site : sites) {
+            if (site.growth > budget) continue;
+            irInsertFunction(site);
+            budget -= std::max(site.growth, 0);
+            changed = true;
+        }
+        irFixPrev(fundec);
+        delete caller;
+        caller = irMakeFunction(fundec);
+        if (!changed) {
+            break;
         }
     }
+    delete caller;
 }
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.h"
+#include "ir.hpp"
+
+#define PROFILE_DEPTH 10000 // nested calls allowed in a profiling run, each a host stack frame
+
+#define PROFILE_WORDS (1 << 24) // memory words allowed in a profiling run
+
+struct IRVector {
+    int lanes[VECTOR_MAX_LANES];
+};
+
+struct IRFrame {
+    std::unordered_map<Value*, int> values;
+
+    std::unordered_map<Value*, int> addresses;
+
+    std::unordered_map<Value*, IRVector> vectors;
+};
+
+struct IRInterpreter {
+    std::unordered_map<std::string, Code*> functions;
+
+    std::unordered_map<Value*, Code*> labels;
+
+    std::vector<int> memory;
+
+    int sp = 0;
+
+    long long steps = -1; // instructions left before trapping, negative for no limit
+
+    int depth = 0; // calls in progress
+
+    int maxDepth = -1; // calls allowed in progress before trapping, negative for no limit
+
+    long long maxWords = -1; // memory words allowed before trapping, negative for no limit
+
+    bool trapped = false; // out of steps or memory, calls nested too deep or divided by zero
+
+    int scratch = 0; // the word an access out of memory reads and writes
+
+    bool countHits = true;
+
+    IRInterpreter(Code* code) {
+        while (code) {
+            if (code->opcode == IR_FUNDEC) {
+                functions[code->result->to_string()] = code;
+            } else if (code->opcode == IR_LABEL) {
+                labels[code->result] = code;
+            }
+            code = code->next;
+        }
+    }
+
+    int eval(IRFrame& frame, Value* v) {
+        if (!v) return 0;
+        if (v->type == VT_CONST) return v->val;
+        return frame.values[v];
+    }
+
+    int& word(long long addr) {
+        if (addr < 0 || (maxWords >= 0 && addr / 4 >= maxWords)) {
+            trapped = true;
+            scratch = 0;
+            return scratch;
+        }
+        if (addr / 4 >= memory.size()) {
+            memory.resize(addr / 4 + 1);
+        }
+        return memory[addr / 4];
+    }
+
+    // whether the n words from addr on are in memory, growing it if needed
+    bool reach(long long addr, int n) {
+        word(addr);
+        word(addr + 4LL * n);
+        return !trapped;
+    }
+
+    // an operand of a vector operation; a scalar is the same in every lane
+    IRVector lanes(IRFrame& frame, Value* v) {
+        IRVector vector;
+        auto iter = frame.vectors.find(v);
+        if (iter != frame.vectors.end()) {
+            return iter->second;
+        }
+        int val = eval(frame, v);
+        for (int& lane : vector.lanes) {
+            lane = val;
+        }
+        return vector;
+    }
+
+    // every operation is one plain loop over its lanes, left for the host
+    // compiler to turn into SSE/AVX instructions
+    void vector(IRFrame& frame, Code* code) {
+        int n = code->size;
+        IRVector a = lanes(frame, code->arg1), b = lanes(frame, code->arg2), r;
+        switch (code->opcode) {
+            case IR_VLOAD: {
+                int addr = eval(frame, code->arg1);
+                if (!reach(addr, n)) return;
+                for (int i = 0; i < n; i++) r.lanes[i] = memory[addr / 4 + i];
+                break;
+            }
+            case IR_VSTORE: {
+                int addr = eval(frame, code->result);
+                if (!reach(addr, n)) return;
+                for (int i = 0; i < n; i++) memory[addr / 4 + i] = a.lanes[i];
+                return;
+            }
+            case IR_VADD: for (int i = 0; i < n; i++) r.lanes[i] = a.lanes[i] + b.lanes[i]; break;
+            case IR_VMINUS: for (int i = 0; i < n; i++) r.lanes[i] = a.lanes[i] - b.lanes[i]; break;
+            case IR_VMUL: for (int i = 0; i < n; i++) r.lanes[i] = a.lanes[i] * b.lanes[i]; break;
+            case IR_VSTEP: for (int i = 0; i < n; i++) r.lanes[i] = a.lanes[0] + i * b.lanes[0]; break;
+            default:
+                ;
+        }
+        frame.vectors[code->result] = r;
+    }
+
+    // FILL and COPY of n bytes, done by the library routines
+    void bulk(IRFrame& frame, Code* code) {
+        int dst = eval(frame, code->result), n = eval(frame, code->arg2) / 4;
+        if (n <= 0) {
+            return;
+        }
+        if (!reach(dst, n)) {
+            return;
+        }
+        if (code->opcode == IR_FILL) {
+            std::fill_n(memory.begin() + dst / 4, n, eval(frame, code->arg1));
+        } else {
+            int src = eval(frame, code->arg1);
+            if (!reach(src, n)) {
+                return;
+            }
+            memmove(&memory[dst / 4], &memory[src / 4], n * sizeof(int));
+        }
+    }
+
+    // each SPL call is a C++ call, so maxDepth bounds the host stack used
+    int call(Code* fundec, const std::vector<int>& args) {
+        if (maxDepth >= 0 && depth >= maxDepth) {
+            trapped = true;
+        }
+        if (trapped) {
+            return 0;
+        }
+        depth++;
+        IRFrame frame;
+        std::vector<int> pending;
+        int savedSp = sp;
+        int argIndex = 0;
+        fundec->hits += countHits;
+        Code* code = fundec->next;
+        while (code && code->opcode != IR_FUNDEC) {
+            if (steps == 0) {
+                trapped = true;
+            }
+            if (trapped) {
+                sp = savedSp;
+                depth--;
+                return 0;
+            }
+            steps -= steps > 0;
+            code->hits += countHits;
+            Value* arg1 = code->arg1;
+            Value* arg2 = code->arg2;
+            Value* result = code->result;
+            Code* next = code->next;
+            switch (code->opcode) {
+                case IR_MOVE: frame.values[result] = eval(frame, arg1); break;
+                case IR_ADD: frame.values[result] = eval(frame, arg1) + eval(frame, arg2); break;
+                case IR_MINUS: frame.values[result] = eval(frame, arg1) - eval(frame, arg2); break;
+                case IR_MUL: frame.values[result] = eval(frame, arg1) * eval(frame, arg2); break;
+                case IR_DIV: {
+                    int divisor = eval(frame, arg2);
+                    if (divisor == 0) {
+                        trapped = true;
+                        break;
+                    }
+                    frame.values[result] = eval(frame, arg1) / divisor;
+                    break;
+                }
+                case IR_GOTO: next = labels[result]; break;
+                case IR_IFGOTO: {
+                    if (irCompare(code->relop, eval(frame, arg1), eval(frame, arg2))) {
+                        next = labels[result];
+                    }
+                    break;
+                }
+                case IR_READ: {
+                    int val = 0;
+                    if (scanf("%d", &val) != 1) {
+                        val = 0;
+                    }
+                    frame.values[result] = val;
+                    break;
+                }
+                case IR_WRITE: printf("%d\n", eval(frame, result)); break;
+                case IR_ARG: pending.push_back(eval(frame, result)); break;
+                case IR_PARAM: {
+                    frame.values[result] = argIndex < args.size() ? args[args.size() - 1 - argIndex] : 0;
+                    argIndex++;
+                    break;
+                }
+                case IR_CALL: {
+                    auto iter = functions.find(arg1->to_string());
+                    std::vector<int> callArgs;
+                    callArgs.swap(pending);
+                    frame.values[result] = iter == functions.end() ? 0 : call(iter->second, callArgs);
+                    break;
+                }
+                case IR_RETURN: {
+                    int val = eval(frame, result);
+                    sp = savedSp;
+                    depth--;
+                    return val;
+                }
+                case IR_ALLOC: {
+                    frame.addresses[result] = sp;
+                    sp += code->size;
+                    word(sp);
+                    break;
+                }
+                case IR_LOADADDR: frame.values[result] = frame.addresses[arg1]; break;
+                case IR_LOAD: frame.values[result] = word(eval(frame, arg1)); break;
+                case IR_STORE: word(eval(frame, result)) = eval(frame, arg1); break;
+                case IR_VLOAD:
+                case IR_VSTORE:
+                case IR_VADD:
+                case IR_VMINUS:
+                case IR_VMUL:
+                case IR_VSTEP:
+                    vector(frame, code);
+                    break;
+                case IR_FILL:
+                case IR_COPY:
+                    bulk(frame, code);
+                    break;
+                default:
+                    ;
+            }
+            code = next;
+        }
+        sp = savedSp;
+        depth--;
+        return 0;
+    }
+
+    int run() {
+        auto iter = functions.find("main");
+        if (iter == functions.end()) {
+            return 0;
+        }
+        return call(iter->second, {});
+    }
+};
+
+// the profiling run of the whole program; false if it trapped
+bool irInterpret(Code* head) {
+    IRInterpreter interpreter(head);
+    interpreter.maxDepth = PROFILE_DEPTH;
+    interpreter.maxWords = PROFILE_WORDS;
+    interpreter.run();
+    return !interpreter.trapped;
+}
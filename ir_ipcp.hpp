@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.h"
+#include "ir.hpp"
+#include "ir_cfg.hpp"
+#include "ir_inliner.hpp"
+#include "ir_optimizer.hpp"
+#include "ir_profile.hpp"
+
+#define SPECIALIZE_MAX_CLONES 4 // clones per function
+
+#define SPECIALIZE_BUDGET_PERCENT 50 // cloned code allowed relative to the program size
+
+struct CallSite {
+    Code* caller;
+
+    Code* call;
+
+    std::vector<Code*> args; // in ARG order, i.e. last parameter first
+
+    Value* arg(int param) const {
+        return args[args.size() - param - 1]->result;
+    }
+};
+
+// every call site from code to the end, by callee, in one walk
+void irCollectCallSites(Code* code, std::unordered_map<std::string, std::vector<CallSite>>& sites) {
+    std::vector<Code*> args;
+    Code* caller = nullptr;
+    for (; code; code = code->next) {
+        if (code->opcode == IR_FUNDEC) {
+            caller = code;
+        } else if (code->opcode == IR_ARG) {
+            args.push_back(code);
+        } else if (code->opcode == IR_CALL) {
+            sites[code->arg1->to_string()].push_back({ caller, code, args });
+            args.clear();
+        } else if (code->opcode != IR_LABEL) {
+            args.clear();
+        }
+    }
+}
+
+// no sites at all if any call is malformed, so the function is left alone
+std::vector<CallSite> irWellFormedSites(const std::vector<CallSite>& sites, int paramCount) {
+    for (const CallSite& site : sites) {
+        if (site.args.size() != paramCount) {
+            return {};
+        }
+    }
+    return sites;
+}
+
+// bind parameters to constants at the function entry; the PARAMs and the
+// matching ARGs at every given call site are removed
+void irBindParams(Code* fundec, const std::vector<Value*>& constants, const std::vector<CallSite>& sites) {
+    Code* entry = fundec;
+    std::vector<Code*> params;
+    while (entry->next && entry->next->opcode == IR_PARAM) {
+        entry = entry->next;
+        params.push_back(entry);
+    }
+    for (int i = 0; i < params.size(); i++) {
+        if (!constants[i]) continue;
+        irInsertAfter(entry, new Code(IR_MOVE, constants[i], params[i]->result));
+        for (const CallSite& site : sites) {
+            disableInst(site.args[site.args.size() - i - 1]);
+        }
+    }
+    for (int i = 0; i < params.size(); i++) {
+        if (constants[i]) {
+            disableInst(params[i]);
+        }
+    }
+}
+
+// locals and labels are renamed like an inlined copy, so constant
+// propagation, which counts assignments per value over the whole program,
+// sees the clone's bound parameters as assigned once
+Code* irCloneFunction(Code* fundec, const std::string& name) {
+    std::unordered_map<Value*, Value*> remapping;
+    Code* head = new Code(IR_FUNDEC, makeSV(strdup(name.c_str())));
+    Code* tail = head;
+    for (Code* code = fundec->next; code && code->opcode != IR_FUNDEC; code = code->next) {
+        tail = irInsertAfter(tail, irCopyCode(code, remapping));
+    }
+    return head;
+}
+
+std::string irSpecializedName(const std::string& name, const std::vector<Value*>& constants) {
+    std::string result = name;
+    for (Value* constant : constants) {
+        if (!constant) {
+            result += "_n";
+        } else if (constant->val < 0) {
+            result += "_m" + std::to_string(-constant->val);
+        } else {
+            result += "_" + std::to_string(constant->val);
+        }
+    }
+    while (functions.find(result) != functions.end()) {
+        result += "_";
+    }
+    return result;
+}
+
+// propagate constant arguments every caller agrees on into the callee, and
+// clone specialized copies for the constant tuples callers disagree on
+Code* irInterproceduralConstantOpt(Code* code) {
+    if (!code) return code;
+    irFixPrev(code);
+    irFindAllFunctions(code);
+    int budget = 32;
+    for (auto& iter : functions) {
+        budget += iter.second->size * SPECIALIZE_BUDGET_PERCENT / 100;
+    }
+
+    Code* last = code;
+    while (last->next) {
+        last = last->next;
+    }
+    std::unordered_map<std::string, std::vector<CallSite>> callSites;
+    irCollectCallSites(code, callSites);
+    for (Code* fundec : irFindFunctionHeads(code)) {
+        std::string name = fundec->result->to_string();
+        IRFunction* function = functions[name];
+        int paramCount = function->params.size();
+        if (name == "main" || paramCount == 0) continue;
+        // the inliner substitutes the arguments at a lone call site anyway
+        if (function->calls == 1 && irCanInline(function)) continue;
+        std::vector<CallSite> sites = irWellFormedSites(callSites[name], paramCount);
+        if (sites.empty()) continue;
+
+        // a recursive call passing the parameter through agrees with any
+        // value, unless the body may have changed the parameter before it
+        std::vector<Value*> agreed(paramCount, nullptr);
+        bool any = false;
+        for (int i = 0; i < paramCount; i++) {
+            Value* value = nullptr;
+            bool agree = true;
+            bool passedThrough = !irWritesValue(function, function->params[i]);
+            for (const CallSite& site : sites) {
+                Value* arg = site.arg(i);
+                if (site.caller == fundec && arg == function->params[i] && passedThrough) continue;
+                if (!isConstant(arg) || (value && arg->val != value->val)) {
+                    agree = false;
+                    break;
+                }
+                value = arg;
+            }
+            agreed[i] = agree ? value : nullptr;
+            any = any || agreed[i];
+        }
+        if (any) {
+            irBindParams(fundec, agreed, sites);
+            paramCount = 0;
+            for (Value* value : agreed) {
+                paramCount += !value;
+            }
+            for (CallSite& site : sites) { // drop the ARGs just removed
+                std::vector<Code*> args;
+                for (int i = 0; i < site.args.size(); i++) {
+                    if (!agreed[site.args.size() - i - 1]) {
+                        args.push_back(site.args[i]);
+                    }
+                }
+                site.args = args;
+            }
+            callSites[name] = sites;
+        }
+
+        // a clone of a recursive function still recurses into the generic
+        // version, so only its first level would be specialized
+        if (function->recursive) continue;
+
+        std::map<std::vector<int>, std::vector<CallSite>> groups;
+        for (const CallSite& site : sites) {
+            std::vector<int> key;
+            bool constant = false;
+            for (int i = 0; i < paramCount; i++) {
+                bool isConst = isConstant(site.arg(i));
+                key.push_back(isConst);
+                key.push_back(isConst ? site.arg(i)->val : 0);
+                constant = constant || isConst;
+            }
+            if (constant && irIsHotCall(site.call)) {
+                groups[key].push_back(site);
+            }
+        }
+        // hottest constant tuples first
+        std::vector<std::pair<long long, std::vector<CallSite>>> ranked;
+        for (auto& group : groups) {
+            long long hits = 0;
+            for (const CallSite& site : group.second) {
+                hits += site.call->hits;
+            }
+            ranked.push_back({ hits, group.second });
+        }
+        std::stable_sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) {
+            return a.first > b.first;
+        });
+        int clones = 0;
+        for (auto& group : ranked) {
+            if (clones >= SPECIALIZE_MAX_CLONES || function->size > budget) break;
+            if (group.second.size() == sites.size()) continue;
+            std::vector<Value*> constants(paramCount, nullptr);
+            for (int i = 0; i < paramCount; i++) {
+                Value* value = group.second[0].arg(i);
+                constants[i] = isConstant(value) ? value : nullptr;
+            }
+            std::string cloneName = irSpecializedName(name, constants);
+            Code* clone = irCloneFunction(fundec, cloneName);
+            functions[cloneName] = nullptr;
+            irBindParams(clone, constants, group.second);
+            for (const CallSite& site : group.second) {
+                site.call->arg1 = clone->result;
+            }
+            last->next = clone;
+            clone->prev = last;
+            while (last->next) {
+                last = last->next;
+            }
+            irCollectCallSites(clone, callSites);
+            budget -= function->size;
+            clones++;
+        }
+    }
+    irFixPrev(code);
+    irFindAllFunctions(code);
+    return irRemoveDeadFunctions(code);
+}
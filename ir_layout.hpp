@@ -0,0 +1,196 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include "ast.h"
+#include "ir.hpp"
+#include "ir_cfg.hpp"
+#include "ir_codegen.hpp"
+#include "ir_optimizer.hpp"
+#include "ir_profile.hpp"
+
+struct LayoutEdge {
+    BasicBlock* from;
+    BasicBlock* to;
+    long long weight;
+    bool back;
+};
+
+void irEstimateFrequency(IRFunctionCFG* cfg) {
+    irComputeLoopDepth(cfg);
+    for (BasicBlock* block : cfg->blocks) {
+        block->freq = profile_loaded ? 0 : 1;
+        if (profile_loaded) {
+            for (Code* code : irBlockCodes(block)) {
+                block->freq = std::max(block->freq, code->hits);
+            }
+        } else {
+            for (int i = 0; i < block->depth && i < 6; i++) {
+                block->freq *= 8;
+            }
+        }
+    }
+}
+
+BasicBlock* irFallBlock(IRFunctionCFG* cfg, BasicBlock* block) {
+    if (block->tail->opcode == IR_GOTO || block->tail->opcode == IR_RETURN) {
+        return nullptr;
+    }
+    return block->id + 1 < cfg->blocks.size() ? cfg->blocks[block->id + 1] : nullptr;
+}
+
+BasicBlock* irJumpBlock(BasicBlock* block) {
+    if (block->tail->opcode != IR_GOTO && block->tail->opcode != IR_IFGOTO) {
+        return nullptr;
+    }
+    for (BasicBlock* succ : block->succs) {
+        if (succ->label() == block->tail->result) {
+            return succ;
+        }
+    }
+    return nullptr;
+}
+
+void irLayoutFunction(IRFunctionCFG* cfg) {
+    auto& blocks = cfg->blocks;
+    int n = blocks.size();
+    if (n < 2) return;
+    irEstimateFrequency(cfg);
+
+    std::vector<bool> reachable(n, false);
+    std::vector<BasicBlock*> stack { blocks[0] };
+    reachable[0] = true;
+    while (!stack.empty()) {
+        BasicBlock* block = stack.back();
+        stack.pop_back();
+        for (BasicBlock* succ : block->succs) {
+            if (!reachable[succ->id]) {
+                reachable[succ->id] = true;
+                stack.push_back(succ);
+            }
+        }
+    }
+
+    // greedy bottom-up chaining: the heaviest edges become fall-throughs,
+    // back edges and then later blocks win ties so loops get rotated with
+    // the test at the bottom
+    std::vector<LayoutEdge> edges;
+    for (BasicBlock* block : blocks) {
+        if (!reachable[block->id]) continue;
+        for (BasicBlock* succ : block->succs) {
+            edges.push_back({ block, succ, std::min(block->freq, succ->freq), succ->id <= block->id });
+        }
+    }
+    std::stable_sort(edges.begin(), edges.end(), [](const LayoutEdge& a, const LayoutEdge& b) {
+        if (a.weight != b.weight) return a.weight > b.weight;
+        if (a.back != b.back) return a.back;
+        return a.from->id > b.from->id;
+    });
+
+    // a block falling off the end of the function must stay last
+    BasicBlock* fallOff = irIsTerminator(blocks[n - 1]->tail->opcode) ? nullptr : blocks[n - 1];
+
+    // chains are found through a union-find and the shorter one is copied
+    // into the longer, so merging stays O(n log n) on huge functions
+    std::vector<int> chainOf(n);
+    std::vector<std::deque<BasicBlock*>> chains(n);
+    for (int i = 0; i < n; i++) {
+        chainOf[i] = i;
+        chains[i].push_back(blocks[i]);
+    }
+    auto chainFind = [&](int i) {
+        while (chainOf[i] != i) {
+            i = chainOf[i] = chainOf[chainOf[i]];
+        }
+        return i;
+    };
+    for (const LayoutEdge& edge : edges) {
+        int a = chainFind(edge.from->id), b = chainFind(edge.to->id);
+        if (a == b || edge.to == blocks[0] || edge.to == fallOff) continue;
+        if (chains[a].back() != edge.from || chains[b].front() != edge.to) continue;
+        if (chains[a].size() >= chains[b].size()) {
+            chains[a].insert(chains[a].end(), chains[b].begin(), chains[b].end());
+        } else {
+            chains[b].insert(chains[b].begin(), chains[a].begin(), chains[a].end());
+            chains[a].swap(chains[b]);
+        }
+        chains[b].clear();
+        chainOf[b] = a;
+    }
+
+    std::vector<BasicBlock*> order(chains[0].begin(), chains[0].end());
+    for (int i = 1; i < n; i++) {
+        if (chains[i].empty() || !reachable[i] || blocks[i] == fallOff) continue;
+        order.insert(order.end(), chains[i].begin(), chains[i].end());
+    }
+    if (fallOff && reachable[fallOff->id]) {
+        order.push_back(fallOff);
+    }
+
+    std::vector<Code*> labels(n, nullptr);
+    auto labelOf = [&](BasicBlock* block) -> Value* {
+        if (block->label()) return block->label();
+        if (!labels[block->id]) labels[block->id] = new Code(IR_LABEL, makeLabel());
+        return labels[block->id]->result;
+    };
+
+    // a jump to a block that is only a conditional test is replaced by a
+    // copy of the test, which saves the jump when entering rotated loops
+    auto emitJump = [&](std::vector<Code*>& codes, BasicBlock* target, BasicBlock* next) {
+        Code* test = target->tail;
+        BasicBlock* testJump = irJumpBlock(target);
+        BasicBlock* testFall = irFallBlock(cfg, target);
+        bool onlyTest = test->opcode == IR_IFGOTO && (target->head == test || target->head->next == test);
+        if (onlyTest && testJump && testFall && next && testJump == next && rev_relop(test->relop) != IR_NOP) {
+            codes.push_back(new Code(IR_IFGOTO, test->arg1, test->arg2, labelOf(testFall), rev_relop(test->relop)));
+        } else if (onlyTest && testJump && testFall && next && testFall == next) {
+            codes.push_back(new Code(IR_IFGOTO, test->arg1, test->arg2, labelOf(testJump), test->relop));
+        } else {
+            codes.push_back(new Code(IR_GOTO, labelOf(target)));
+        }
+    };
+
+    std::vector<std::vector<Code*>> emitted;
+    for (int i = 0; i < order.size(); i++) {
+        BasicBlock* block = order[i];
+        BasicBlock* next = i + 1 < order.size() ? order[i + 1] : nullptr;
+        BasicBlock* jump = irJumpBlock(block);
+        BasicBlock* fall = irFallBlock(cfg, block);
+        std::vector<Code*> codes = irBlockCodes(block);
+        Code* tail = block->tail;
+        if (tail->opcode == IR_GOTO && jump) {
+            codes.pop_back();
+            if (jump != next) {
+                emitJump(codes, jump, next);
+            }
+        } else if (tail->opcode == IR_IFGOTO && fall && fall != next) {
+            if (jump == next && rev_relop(tail->relop) != IR_NOP) {
+                tail->relop = rev_relop(tail->relop);
+                tail->result = labelOf(fall);
+            } else {
+                emitJump(codes, fall, next);
+            }
+        } else if (tail->opcode != IR_IFGOTO && fall && fall != next) {
+            emitJump(codes, fall, next);
+        }
+        emitted.push_back(codes);
+    }
+    for (int i = 0; i < order.size(); i++) {
+        Code* label = labels[order[i]->id];
+        if (label) {
+            emitted[i].insert(emitted[i].begin(), label);
+        }
+    }
+    irRelinkBlocks(cfg, emitted);
+}
+
+void irBlockLayout(Code* code) {
+    irFixPrev(code);
+    for (Code* fundec : irFindFunctionHeads(code)) {
+        IRFunctionCFG* cfg = irBuildCFG(fundec);
+        irLayoutFunction(cfg);
+        delete cfg;
+    }
+}
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "ast.h"
+#include "ir.hpp"
+#include "ir_alias.hpp"
+#include "ir_cfg.hpp"
+#include "ir_optimizer.hpp"
+
+// a word of memory as far as the alias analysis can tell: a variable at a
+// known offset, a variable at any offset (-1), or with no base anything a
+// parameter or a leaked address may reach
+struct IRLocation {
+    Value* base;
+
+    int offset;
+};
+
+typedef std::pair<Value*, int> IRWord;
+
+// the value each word is known to hold, from a store to it or a load of it
+typedef std::map<IRWord, Value*> IRMemoryFacts;
+
+// the words a later load may still read
+struct IRLiveMemory {
+    std::set<IRWord> words;
+
+    std::set<Value*> bases; // read at an unknown offset
+
+    bool shared = false; // something reachable through a parameter or leaked address is read
+
+    bool operator==(const IRLiveMemory& other) const {
+        return words == other.words && bases == other.bases && shared == other.shared;
+    }
+};
+
+struct IRMemoryState {
+    IRAliasInfo info;
+
+    std::unordered_set<Value*> shared; // leaked or reached by an access of unknown base
+
+    std::vector<Code*> removed;
+
+    IRLocation locate(Code* code, Value* address) {
+        auto iter = info.accesses.find(code);
+        if (iter != info.accesses.end()) {
+            return { iter->second.base, iter->second.offset };
+        }
+        auto pointees = info.pointees.find(address);
+        if (pointees != info.pointees.end() && pointees->second.size() == 1 && pointees->second[0]) {
+            return { pointees->second[0], -1 };
+        }
+        return { nullptr, -1 };
+    }
+
+    bool mayAlias(const IRLocation& location, const IRWord& word) {
+        if (!location.base) {
+            return shared.count(word.first);
+        }
+        return location.base == word.first && (location.offset < 0 || location.offset == word.second);
+    }
+};
+
+void irForgetValue(IRMemoryFacts& facts, Value* value) {
+    for (auto iter = facts.begin(); iter != facts.end(); ) {
+        iter = iter->second == value ? facts.erase(iter) : std::next(iter);
+    }
+}
+
+void irForgetAliases(IRMemoryState& state, IRMemoryFacts& facts, const IRLocation& location) {
+    for (auto iter = facts.begin(); iter != facts.end(); ) {
+        iter = state.mayAlias(location, iter->first) ? facts.erase(iter) : std::next(iter);
+    }
+}
+
+// store-to-load forwarding and redundant load elimination: a load of a
+// word known to hold some value becomes a move of it, and a store of the
+// value a word already holds is dropped
+void irForwardBlock(IRMemoryState& state, BasicBlock* block, IRMemoryFacts& facts, bool rewrite) {
+    for (Code* code = block->head; ; code = code->next) {
+        switch (code->opcode) {
+            case IR_LOAD: {
+                IRLocation location = state.locate(code, code->arg1);
+                Value* value = code->result;
+                if (location.offset >= 0) {
+                    auto iter = facts.find({ location.base, location.offset });
+                    if (iter != facts.end()) {
+                        value = iter->second;
+                        if (rewrite) {
+                            code->opcode = IR_MOVE;
+                            code->arg1 = value;
+                        }
+                    }
+                }
+                irForgetValue(facts, code->result);
+                if (location.offset >= 0) {
+                    facts[{ location.base, location.offset }] = value;
+                }
+                break;
+            }
+            case IR_STORE: {
+                IRLocation location = state.locate(code, code->result);
+                if (location.offset >= 0) {
+                    auto iter = facts.find({ location.base, location.offset });
+                    if (iter != facts.end() && iter->second == code->arg1) {
+                        if (rewrite) {
+                            state.removed.push_back(code);
+                        }
+                        break;
+                    }
+                }
+                irForgetAliases(state, facts, location);
+                if (location.offset >= 0) {
+                    facts[{ location.base, location.offset }] = code->arg1;
+                }
+                break;
+            }
+            case IR_VSTORE:
+            case IR_FILL:
+            case IR_COPY:
+                irForgetAliases(state, facts, state.locate(code, code->result));
+                break;
+            case IR_CALL:
+                irForgetAliases(state, facts, { nullptr, -1 });
+                irForgetValue(facts, code->result);
+                break;
+            default:
+                if (irDefinesResult(code->opcode)) {
+                    irForgetValue(facts, code->result);
+                }
+        }
+        if (code == block->tail) break;
+    }
+}
+
+void irForwardMemory(IRMemoryState& state, IRFunctionCFG* cfg) {
+    int count = cfg->blocks.size();
+    std::vector<IRMemoryFacts> in(count), out(count);
+    std::vector<bool> visited(count, false);
+    auto meet = [&](BasicBlock* block) {
+        IRMemoryFacts facts;
+        bool first = true;
+        for (BasicBlock* pred : block->preds) {
+            if (!visited[pred->id]) continue;
+            if (first) {
+                facts = out[pred->id];
+                first = false;
+                continue;
+            }
+            for (auto iter = facts.begin(); iter != facts.end(); ) {
+                auto other = out[pred->id].find(iter->first);
+                bool agreed = other != out[pred->id].end() && other->second == iter->second;
+                iter = agreed ? std::next(iter) : facts.erase(iter);
+            }
+        }
+        return facts;
+    };
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (BasicBlock* block : cfg->blocks) {
+            IRMemoryFacts facts = block->id == 0 ? IRMemoryFacts() : meet(block);
+            if (visited[block->id] && facts == in[block->id]) continue;
+            visited[block->id] = true;
+            in[block->id] = facts;
+            irForwardBlock(state, block, facts, false);
+            changed |= facts != out[block->id];
+            out[block->id] = facts;
+        }
+    }
+    for (BasicBlock* block : cfg->blocks) {
+        if (visited[block->id]) {
+            irForwardBlock(state, block, in[block->id], true);
+        }
+    }
+}
+
+// dead store elimination: a store to a word no later load may read before
+// it is stored again, or before the function returns and its DECs go away
+void irLiveBlock(IRMemoryState& state, BasicBlock* block, IRLiveMemory& live, const std::unordered_set<Code*>& removed, bool rewrite) {
+    for (Code* code = block->tail; ; code = code->prev) {
+        if (removed.count(code)) {
+            // dropped by irForwardMemory
+        } else if (irReadAddress(code)) {
+            IRLocation location = state.locate(code, code->arg1);
+            if (!location.base) {
+                live.shared = true;
+            } else if (location.offset < 0) {
+                live.bases.insert(location.base);
+            } else {
+                live.words.insert({ location.base, location.offset });
+            }
+        } else if (code->opcode == IR_STORE) {
+            IRLocation location = state.locate(code, code->result);
+            if (location.offset >= 0) {
+                IRWord word = { location.base, location.offset };
+                bool read = live.words.count(word) || live.bases.count(location.base) || (live.shared && state.shared.count(location.base));
+                if (!read && rewrite) {
+                    state.removed.push_back(code);
+                }
+                live.words.erase(word);
+            }
+        } else if (code->opcode == IR_CALL) {
+            live.shared = true;
+        } else if (code->opcode == IR_RETURN) {
+            live = IRLiveMemory();
+        }
+        if (code == block->head) break;
+    }
+}
+
+void irEliminateDeadStores(IRMemoryState& state, IRFunctionCFG* cfg) {
+    std::unordered_set<Code*> removed(state.removed.begin(), state.removed.end());
+    int count = cfg->blocks.size();
+    std::vector<IRLiveMemory> in(count);
+    auto meet = [&](BasicBlock* block) {
+        IRLiveMemory live;
+        for (BasicBlock* succ : block->succs) {
+            const IRLiveMemory& other = in[succ->id];
+            live.words.insert(other.words.begin(), other.words.end());
+            live.bases.insert(other.bases.begin(), other.bases.end());
+            live.shared |= other.shared;
+        }
+        return live;
+    };
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (int i = count - 1; i >= 0; i--) {
+            IRLiveMemory live = meet(cfg->blocks[i]);
+            irLiveBlock(state, cfg->blocks[i], live, removed, false);
+            if (!(live == in[i])) {
+                in[i] = live;
+                changed = true;
+            }
+        }
+    }
+    for (BasicBlock* block : cfg->blocks) {
+        IRLiveMemory live = meet(block);
+        irLiveBlock(state, block, live, removed, true);
+    }
+}
+
+void irMemoryFunction(Code* fundec) {
+    IRMemoryState state;
+    irAnalyzeAliases(fundec, state.info);
+    if (state.info.accesses.empty()) {
+        return;
+    }
+    state.shared = state.info.leaked;
+    for (Code* code = fundec->next; code && code->opcode != IR_FUNDEC; code = code->next) {
+        for (Value* address : { irReadAddress(code), irWrittenAddress(code) }) {
+            if (address && !state.locate(code, address).base) {
+                auto iter = state.info.pointees.find(address);
+                if (iter != state.info.pointees.end()) {
+                    state.shared.insert(iter->second.begin(), iter->second.end());
+                }
+            }
+        }
+    }
+
+    IRFunctionCFG* cfg = irBuildCFG(fundec);
+    irForwardMemory(state, cfg);
+    irEliminateDeadStores(state, cfg);
+    delete cfg;
+    for (Code* code : state.removed) {
+        disableInst(code);
+    }
+}
+
+// loads and stores of DEC'd variables at constant offsets, which scalar
+// replacement leaves behind for variables also accessed at unknown offsets
+// or passed to calls
+void irMemoryOpt(Code* code) {
+    irFixPrev(code);
+    for (Code* fundec : irFindFunctionHeads(code)) {
+        irMemoryFunction(fundec);
+    }
+}
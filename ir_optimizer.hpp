@@ -9,7 +9,8 @@
 
 #define ENABLE_OPT 100
 
-void disableInst(Code* code) {
+// take an instruction out of the list, to be inserted elsewhere
+void irUnlink(Code* code) {
     if (code->prev) {
         code->prev->next = code->next;
     }
@@ -18,6 +19,12 @@ void disableInst(Code* code) {
     }
 }
 
+// remove an instruction for good; its storage is reused later
+void disableInst(Code* code) {
+    irUnlink(code);
+    irRetireCode(code);
+}
+
 IROpCode rev_relop(IROpCode opcode) {
     switch (opcode) {
         case IR_LT: return IR_GE;
@@ -41,6 +48,11 @@ bool irIsAssign(IROpCode opcode) {
         case IR_ALLOC:
         case IR_LOAD:
         case IR_LOADADDR:
+        case IR_VLOAD:
+        case IR_VADD:
+        case IR_VMINUS:
+        case IR_VMUL:
+        case IR_VSTEP:
             return true;
         default:
             return false;
@@ -61,10 +73,13 @@ void irUnusedValueOpt(Code* code) {
             case IR_READ:
             case IR_WRITE:
             case IR_STORE:
+            case IR_VSTORE:
+            case IR_FILL:
+            case IR_COPY:
                 usedValues.insert(code->result);
-            default:
-                usedValues.insert(code->arg1);
-                usedValues.insert(code->arg2);
+            default: // a := a + #c alone does not keep a alive
+                if (code->arg1 != code->result) usedValues.insert(code->arg1);
+                if (code->arg2 != code->result) usedValues.insert(code->arg2);
             case IR_LABEL:
             case IR_NOP:
                 ;
@@ -125,6 +140,10 @@ void irConstantPropOpt(Code* code) {
             case IR_CALL:
             case IR_MOVE: {
                 if (isConstant(arg1)) {
+                    auto iter = constants.find(result);
+                    if (iter != constants.end() && iter->second != arg1->val) {
+                        assignments[result]++;
+                    }
                     constants[result] = arg1->val;
                 } else {
                     assignments[result]++;
@@ -188,6 +207,18 @@ void irConstantPropOpt(Code* code) {
                 assignments[result]++;
                 break;
             }
+            case IR_PARAM:
+            case IR_READ:
+            case IR_LOAD:
+            case IR_LOADADDR:
+            case IR_ALLOC:
+            case IR_VLOAD:
+            case IR_VADD:
+            case IR_VMINUS:
+            case IR_VMUL:
+            case IR_VSTEP:
+                assignments[result]++;
+                break;
             default:
                 ;
         }
@@ -235,6 +266,15 @@ void irPeepholeOpt(Code* code) {
             }
             case IR_IFGOTO:
             case IR_GOTO: {
+                if (opcode == IR_IFGOTO && isConstant(arg1) && isConstant(arg2)) {
+                    if (!irCompare(code->relop, arg1->val, arg2->val)) {
+                        disableInst(code);
+                        break;
+                    }
+                    code->opcode = opcode = IR_GOTO;
+                    code->arg1 = code->arg2 = nullptr;
+                    code->relop = IR_NOP;
+                }
                 if (opcode == IR_IFGOTO && next && next2) {
                     if (next->opcode == IR_GOTO && next2->opcode == IR_LABEL && result == next2->result) {
                         code->relop = rev_relop(code->relop);
@@ -254,16 +294,19 @@ void irPeepholeOpt(Code* code) {
             case IR_MINUS: {
                 Code* code2 = code->prev;
                 if (code2 && code->arg1 == code2->result && (code2->opcode == IR_ADD || code2->opcode == IR_MINUS)) {
-                    if (opcode == IR_MINUS && code->arg2 == code2->arg1 && isConstant(code2->arg2)) {
+                    if (opcode == IR_MINUS && code->arg2 == code2->arg1 && code2->arg1 != code2->result && isConstant(code2->arg2)) {
                         code->opcode = IR_MOVE;
                         code->arg1 = makeCV((code2->opcode == IR_ADD ? 1 : -1) * code2->arg2->val);
                         code->arg2 = nullptr;
                     }
                 }
-                if (code2 && (code2->opcode == IR_ADD || code2->opcode == IR_MINUS)) {
+                if (code2 && code->arg1 == code2->result && (code2->opcode == IR_ADD || code2->opcode == IR_MINUS)) {
                     Value* baseVar;
                     int baseline = 0;
-                    if (code2->opcode != IR_MOVE && isConstant(code2->arg2)) {
+                    // a := a + c1 overwrote its base, unless code overwrites it too
+                    if (code2->arg1 == code2->result && code2->result != code->result) {
+                        break;
+                    } else if (code2->opcode != IR_MOVE && isConstant(code2->arg2)) {
                         baseline = code2->arg2->val;
                         baseVar = code2->arg1;
                     } else {
@@ -321,12 +364,36 @@ void irPeepholeOpt(Code* code) {
     }
 }
 
+size_t irDigestValue(size_t digest, const Value* value) {
+    size_t bits = isConstant(value) ? (size_t) value->val : (size_t) value;
+    return (digest ^ bits) * 0x100000001b3ULL;
+}
+
+// the passes only look at the code, so once a round leaves its digest
+// unchanged every later round would too; constants are folded into fresh
+// values, so they are digested by value and everything else by identity
+size_t irDigest(Code* code) {
+    size_t digest = 0xcbf29ce484222325ULL;
+    for (; code; code = code->next) {
+        digest = (digest ^ (code->opcode << 8 | code->relop)) * 0x100000001b3ULL;
+        digest = irDigestValue(irDigestValue(irDigestValue(digest, code->arg1), code->arg2), code->result);
+    }
+    return digest;
+}
+
 void irOptimize(Code* code) {
+    size_t digest = irDigest(code);
     for (int i = 0; i < ENABLE_OPT; i++) {
         irFixPrev(code);
         irPeepholeOpt(code);
         irUnusedValueOpt(code);
         irLabelOpt(code);
         irConstantPropOpt(code);
+        irRecycleCode();
+        size_t next = irDigest(code);
+        if (next == digest) {
+            break;
+        }
+        digest = next;
     }
 }
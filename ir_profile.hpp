@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+
+#include "ast.h"
+#include "ir.hpp"
+#include "ir_cfg.hpp"
+#include "ir_codegen.hpp"
+
+// profile format: one "<function> <key> <count>" line per entry, where key is
+// "entry", a block label ("label3") or a call site ordinal ("call2")
+
+thread_local bool profile_loaded = false;
+
+thread_local long long profile_max_call = 0;
+
+void irProfileLabelBlocks(Code* code) {
+    while (code) {
+        Code* next = code->next;
+        if (irIsTerminator(code->opcode) && next && next->opcode != IR_LABEL && next->opcode != IR_FUNDEC) {
+            Code* label = new Code(IR_LABEL, makeLabel());
+            code->next = label;
+            label->prev = code;
+            label->next = next;
+            next->prev = label;
+        }
+        code = next;
+    }
+}
+
+template<typename F>
+void irProfileVisit(Code* code, F visit) {
+    std::string function;
+    int calls = 0;
+    while (code) {
+        if (code->opcode == IR_FUNDEC) {
+            function = code->result->to_string();
+            calls = 0;
+            visit(function + " entry", code);
+        } else if (code->opcode == IR_LABEL) {
+            visit(function + " " + code->result->to_string(), code);
+        } else if (code->opcode == IR_CALL) {
+            visit(function + " call" + std::to_string(calls++), code);
+        }
+        code = code->next;
+    }
+}
+
+bool irProfileWrite(Code* code, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    irProfileVisit(code, [file](const std::string& key, Code* code) {
+        fprintf(file, "%s %lld\n", key.c_str(), code->hits);
+    });
+    fclose(file);
+    return true;
+}
+
+bool irProfileRead(Code* code, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    std::unordered_map<std::string, long long> counts;
+    char function[256], key[256];
+    long long count;
+    while (fscanf(file, "%255s %255s %lld", function, key, &count) == 3) {
+        counts[std::string(function) + " " + key] = count;
+    }
+    fclose(file);
+
+    irProfileVisit(code, [&counts](const std::string& key, Code* code) {
+        auto iter = counts.find(key);
+        code->hits = iter == counts.end() ? 0 : iter->second;
+        if (code->opcode == IR_CALL && code->hits > profile_max_call) {
+            profile_max_call = code->hits;
+        }
+    });
+    // spread block counts over every instruction so they survive label removal
+    long long block = 0;
+    for (; code; code = code->next) {
+        if (code->opcode == IR_FUNDEC || code->opcode == IR_LABEL) {
+            block = code->hits;
+        } else if (code->opcode != IR_CALL) {
+            code->hits = block;
+        }
+    }
+    profile_loaded = true;
+    return true;
+}
+
+bool irIsHotCall(Code* call) {
+    return !profile_loaded || (call->hits > 0 && call->hits * 100 >= profile_max_call);
+}
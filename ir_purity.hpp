@@ -0,0 +1,299 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ast.h"
+#include "ir.hpp"
+#include "ir_cfg.hpp"
+#include "ir_inliner.hpp"
+#include "ir_interp.hpp"
+#include "ir_optimizer.hpp"
+
+#define PURE_FOLD_STEPS 100000 // interpreter steps allowed to fold one call
+
+#define PURE_FOLD_DEPTH 256 // nested calls allowed to fold one call, each a host stack frame
+
+struct IRSummary {
+    bool pure = true; // no READ/WRITE, memory only through its own ALLOCs, pure callees
+
+    bool safe = true; // pure and always returns: no loops, calls or division by a variable
+};
+
+thread_local std::unordered_map<std::string, IRSummary> summaries;
+
+bool irIsDefinition(Code* code) {
+    return irIsAssign(code->opcode) || code->opcode == IR_READ || code->opcode == IR_PARAM;
+}
+
+// values that only ever hold addresses inside the function's own ALLOCs,
+// shrunk from all defined values until every definition derives from one
+std::unordered_set<Value*> irLocalAddresses(IRFunction* function) {
+    std::unordered_set<Value*> local;
+    for (Code* code = function->fundec->next; code && code->opcode != IR_FUNDEC; code = code->next) {
+        if (irIsDefinition(code)) {
+            local.insert(code->result);
+        }
+    }
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (Code* code = function->fundec->next; code && code->opcode != IR_FUNDEC; code = code->next) {
+            if (!irIsDefinition(code) || !local.count(code->result)) continue;
+            bool derived = code->opcode == IR_LOADADDR;
+            if (code->opcode == IR_MOVE) {
+                derived = local.count(code->arg1);
+            } else if (code->opcode == IR_ADD) {
+                derived = local.count(code->arg1) != local.count(code->arg2);
+            } else if (code->opcode == IR_MINUS) {
+                derived = local.count(code->arg1) && !local.count(code->arg2);
+            }
+            if (!derived) {
+                local.erase(code->result);
+                changed = true;
+            }
+        }
+    }
+    return local;
+}
+
+void irComputeSummaries() {
+    summaries.clear();
+    std::unordered_map<std::string, std::vector<std::string>> callees;
+    for (auto& iter : functions) {
+        IRFunction* function = iter.second;
+        IRSummary& summary = summaries[iter.first];
+        std::unordered_set<Value*> local = irLocalAddresses(function);
+        std::unordered_set<Value*> labels;
+        for (Code* code = function->entry; code && code->opcode != IR_FUNDEC; code = code->next) {
+            switch (code->opcode) {
+                case IR_READ:
+                case IR_WRITE:
+                    summary.pure = false;
+                    break;
+                case IR_LOAD:
+                case IR_VLOAD:
+                    summary.pure &= local.count(code->arg1) > 0;
+                    break;
+                case IR_STORE:
+                case IR_VSTORE:
+                case IR_FILL:
+                    summary.pure &= local.count(code->result) > 0;
+                    break;
+                case IR_COPY:
+                    summary.pure &= local.count(code->arg1) > 0 && local.count(code->result) > 0;
+                    break;
+                case IR_CALL:
+                    summary.safe = false;
+                    if (functions.find(code->arg1->to_string()) == functions.end()) {
+                        summary.pure = false;
+                    } else {
+                        callees[iter.first].push_back(code->arg1->to_string());
+                    }
+                    break;
+                case IR_DIV:
+                    summary.safe &= isConstant(code->arg2) && code->arg2->val != 0;
+                    break;
+                case IR_LABEL:
+                    labels.insert(code->result);
+                    break;
+                case IR_GOTO:
+                case IR_IFGOTO:
+                    summary.safe &= !labels.count(code->result); // backward jump
+                    break;
+                default:
+                    ;
+            }
+        }
+        summary.safe &= summary.pure;
+    }
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (auto& iter : callees) {
+            IRSummary& summary = summaries[iter.first];
+            for (const std::string& callee : iter.second) {
+                if (summary.pure && !summaries[callee].pure) {
+                    summary.pure = summary.safe = false;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+std::vector<Code*> irCallArgs(Code* call) {
+    std::vector<Code*> args;
+    for (Code* arg = call->prev; arg && arg->opcode == IR_ARG; arg = arg->prev) {
+        args.insert(args.begin(), arg);
+    }
+    return args;
+}
+
+// a call to a pure function whose arguments directly precede it
+bool irIsPureCall(Code* code) {
+    if (code->opcode != IR_CALL) return false;
+    auto iter = summaries.find(code->arg1->to_string());
+    if (iter == summaries.end() || !iter->second.pure) return false;
+    return irCallArgs(code).size() == functions[iter->first]->params.size();
+}
+
+// evaluate pure calls whose arguments are all constants at compile time
+void irFoldPureCalls(Code* code) {
+    IRInterpreter interpreter(code);
+    interpreter.countHits = false;
+    interpreter.maxDepth = PURE_FOLD_DEPTH;
+    for (; code; code = code->next) {
+        if (!irIsPureCall(code)) continue;
+        std::vector<Code*> args = irCallArgs(code);
+        IRFunction* callee = functions[code->arg1->to_string()];
+        std::vector<int> values;
+        for (Code* arg : args) {
+            if (!isConstant(arg->result)) break;
+            values.push_back(arg->result->val);
+        }
+        if (values.size() != args.size()) continue;
+        interpreter.steps = PURE_FOLD_STEPS;
+        interpreter.trapped = false;
+        int value = interpreter.call(callee->fundec, values);
+        if (interpreter.trapped) continue;
+        for (Code* arg : args) {
+            disableInst(arg);
+        }
+        code->opcode = IR_MOVE;
+        code->arg1 = makeCV(value);
+    }
+}
+
+struct PureCall {
+    std::string callee;
+
+    std::vector<Value*> args;
+
+    Value* result;
+};
+
+// reuse the result of an identical pure call earlier in the same block
+void irPureCallCSE(Code* code) {
+    std::vector<PureCall> available;
+    for (; code; code = code->next) {
+        if (code->opcode == IR_LABEL || code->opcode == IR_FUNDEC) {
+            available.clear();
+            continue;
+        }
+        PureCall call;
+        std::vector<Code*> args;
+        bool reused = false;
+        if (irIsPureCall(code)) {
+            args = irCallArgs(code);
+            call = { code->arg1->to_string(), {}, code->result };
+            for (Code* arg : args) {
+                call.args.push_back(arg->result);
+            }
+            for (const PureCall& prev : available) {
+                bool same = prev.callee == call.callee && prev.args.size() == call.args.size();
+                for (int i = 0; same && i < call.args.size(); i++) {
+                    same = prev.args[i] == call.args[i] || (isConstant(prev.args[i]) && isConstant(call.args[i]) && prev.args[i]->val == call.args[i]->val);
+                }
+                if (same) {
+                    for (Code* arg : args) {
+                        disableInst(arg);
+                    }
+                    code->opcode = IR_MOVE;
+                    code->arg1 = prev.result;
+                    reused = true;
+                    break;
+                }
+            }
+        }
+        if (irIsDefinition(code)) {
+            for (int i = available.size() - 1; i >= 0; i--) {
+                const PureCall& prev = available[i];
+                bool killed = prev.result == code->result;
+                for (Value* arg : prev.args) {
+                    killed = killed || arg == code->result;
+                }
+                if (killed) {
+                    available.erase(available.begin() + i);
+                }
+            }
+        }
+        if (irIsPureCall(code) && !reused) {
+            bool selfReferencing = false;
+            for (Value* arg : call.args) {
+                selfReferencing = selfReferencing || arg == call.result;
+            }
+            if (!selfReferencing) {
+                available.push_back(call);
+            }
+        }
+        if (irIsTerminator(code->opcode)) {
+            available.clear();
+        }
+    }
+}
+
+// move a loop-invariant call to a pure function that always returns in
+// front of the loop header; the only way into the loop must be falling into
+// the header, and the call must be the single definition of its result
+bool irHoistPureCall(Code* fundec) {
+    IRFunctionCFG* cfg = irBuildCFG(fundec);
+    std::unordered_map<Value*, int> definitions;
+    for (Code* code = fundec->next; code != cfg->end; code = code->next) {
+        if (irIsDefinition(code)) {
+            definitions[code->result]++;
+        }
+    }
+    bool hoisted = false;
+    for (BasicBlock* back : cfg->blocks) {
+        for (BasicBlock* header : back->succs) {
+            if (hoisted || header->id > back->id || header->id == 0) continue;
+            BasicBlock* before = cfg->blocks[header->id - 1];
+            Code* tail = before->tail;
+            bool entered = tail->opcode != IR_GOTO && tail->opcode != IR_RETURN;
+            entered &= tail->opcode != IR_IFGOTO || tail->result != header->label();
+            for (BasicBlock* pred : header->preds) {
+                entered &= pred == before || (pred->id >= header->id && pred->id <= back->id);
+            }
+            if (!entered) continue;
+
+            std::unordered_set<Value*> variant;
+            for (Code* code = header->head; code != back->tail->next; code = code->next) {
+                if (irIsDefinition(code)) {
+                    variant.insert(code->result);
+                }
+            }
+            for (Code* code = header->head; !hoisted && code != back->tail->next; code = code->next) {
+                if (!irIsPureCall(code) || !summaries[code->arg1->to_string()].safe) continue;
+                if (definitions[code->result] != 1) continue;
+                std::vector<Code*> args = irCallArgs(code);
+                bool invariant = true;
+                for (Code* arg : args) {
+                    invariant &= !variant.count(arg->result);
+                }
+                if (!invariant) continue;
+                Code* pos = header->head->prev;
+                for (Code* arg : args) {
+                    irUnlink(arg);
+                    pos = irInsertAfter(pos, arg);
+                }
+                irUnlink(code);
+                irInsertAfter(pos, code);
+                hoisted = true;
+            }
+        }
+    }
+    delete cfg;
+    return hoisted;
+}
+
+void irPureCallOpt(Code* code) {
+    irFixPrev(code);
+    irFindAllFunctions(code);
+    irComputeSummaries();
+    irFoldPureCalls(code);
+    irPureCallCSE(code);
+    for (Code* fundec : irFindFunctionHeads(code)) {
+        while (irHoistPureCall(fundec));
+    }
+}
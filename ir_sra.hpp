@@ -0,0 +1,56 @@
+#pragma once
+
+#include <map>
+#include <unordered_set>
+#include <utility>
+
+#include "ast.h"
+#include "ir.hpp"
+#include "ir_alias.hpp"
+#include "ir_cfg.hpp"
+#include "ir_codegen.hpp"
+#include "ir_optimizer.hpp"
+
+// scalar replacement of aggregates: a DEC'd struct or array whose address
+// only ever reaches loads and stores at constant, in-bounds offsets never
+// escapes, so each word it uses becomes a temporary of its own and the
+// DEC, address arithmetic, loads and stores all go away. Passing it to a
+// call is an escape, so this runs again once calls are inlined
+void irScalarReplaceFunction(Code* fundec) {
+    IRAliasInfo info;
+    irAnalyzeAliases(fundec, info);
+    if (info.sizes.empty()) {
+        return;
+    }
+    std::unordered_set<Value*>& escaped = info.inexact;
+    escaped.insert(info.leaked.begin(), info.leaked.end());
+
+    std::map<std::pair<Value*, int>, Value*> slots;
+    for (Code* code = fundec->next; code && code->opcode != IR_FUNDEC; code = code->next) {
+        auto iter = info.accesses.find(code);
+        if (iter == info.accesses.end() || escaped.count(iter->second.base)) {
+            continue;
+        }
+        Value*& temp = slots[{ iter->second.base, iter->second.offset }];
+        if (!temp) {
+            temp = makeTemp();
+        }
+        if (code->opcode == IR_LOAD) {
+            code->opcode = IR_MOVE;
+            code->arg1 = temp;
+        } else { // STORE
+            code->opcode = IR_MOVE;
+            code->result = temp;
+        }
+    }
+}
+
+// subscripts only become constant after constant propagation, so this runs
+// after irOptimize; the address computations it leaves unused are removed
+// by the next one
+void irScalarReplaceOpt(Code* code) {
+    irFixPrev(code);
+    for (Code* fundec : irFindFunctionHeads(code)) {
+        irScalarReplaceFunction(fundec);
+    }
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ast.h"
+#include "ir.hpp"
+#include "ir_codegen.hpp"
+#include "ir_inliner.hpp"
+#include "ir_layout.hpp"
+#include "ir_idiom.hpp"
+#include "ir_memory.hpp"
+#include "ir_optimizer.hpp"
+#include "ir_sra.hpp"
+#include "ir_tailcall.hpp"
+#include "ir_vectorize.hpp"
+
+#define STREAM_QUEUE_LIMIT 64 // functions lowered ahead of the optimizer thread
+
+#define STREAM_INLINE_LIMIT 4096 // instructions kept from emitted functions as inline candidates
+
+// streamed compilation: the parser thread lowers each function as soon as
+// it is reduced and queues it; the optimizer thread optimizes and prints
+// the functions in order while parsing goes on
+struct IRStream {
+    FILE* out;
+
+    bool bulk_memory;
+
+    bool vectorize;
+
+    std::mutex mutex;
+
+    std::condition_variable queued; // a function was queued or the input ended
+
+    std::condition_variable taken; // the optimizer made room in the queue
+
+    std::deque<Code*> queue;
+
+    bool done = false;
+
+    std::vector<Code*> storage; // freed by the optimizer, reused by the parser thread
+
+    std::deque<std::string> kept; // inline candidates, oldest first
+
+    int kept_size = 0;
+
+    std::vector<int> numbers = std::vector<int>(VT_COMPLEX + 1, 1); // next number per value type
+
+    std::thread optimizer;
+};
+
+// both threads create values, so their numbers depend on timing; the
+// printed numbers are assigned here instead, in the order values are
+// first printed. Only constants are ever compared by number
+void irRenumber(IRStream* stream, Code* head) {
+    for (Code* code = head; code; code = code->next) {
+        for (Value* value : { code->arg1, code->arg2, code->result }) {
+            if (value && value->type != VT_CONST && value->type != VT_SYMBOL && !value->numbered) {
+                value->numbered = true;
+                value->val = stream->numbers[value->type]++;
+            }
+        }
+    }
+}
+
+// the passes of irOptimize's pipeline that only look at one function;
+// interprocedural constant propagation, pure call folding and dead
+// function removal need the whole program and are left out
+void irStreamFunction(IRStream* stream, Code* fundec) {
+    irOptimize(fundec);
+    irScalarReplaceOpt(fundec);
+    irTailCallOpt(fundec);
+    irOptimize(fundec);
+    irInlineStreamed(fundec);
+    irOptimize(fundec);
+    irScalarReplaceOpt(fundec);
+    irMemoryOpt(fundec);
+    irOptimize(fundec);
+    irBlockLayout(fundec);
+    irOptimize(fundec);
+    if (stream->bulk_memory) {
+        irIdiomOpt(fundec);
+    }
+    if (stream->vectorize) {
+        irVectorizeOpt(fundec);
+    }
+    if (stream->bulk_memory || stream->vectorize) {
+        irOptimize(fundec);
+    }
+    irRenumber(stream, fundec);
+    irPrint(fundec, stream->out);
+
+    // small functions stay as inline candidates for the ones after them
+    IRFunction* function = irMakeFunction(fundec);
+    std::string name = fundec->result->to_string();
+    for (Code* code = function->entry; code; code = code->next) {
+        function->recursive |= code->opcode == IR_CALL && code->arg1->to_string() == name;
+    }
+    if (irCanInline(function) && function->size <= INLINE_CALLEE_LIMIT) {
+        functions[name] = function;
+        stream->kept.push_back(name);
+        stream->kept_size += function->size;
+    } else {
+        delete function;
+        irFreeCode(fundec);
+    }
+    while (stream->kept_size > STREAM_INLINE_LIMIT) {
+        auto iter = functions.find(stream->kept.front());
+        stream->kept_size -= iter->second->size;
+        irFreeCode(iter->second->fundec);
+        delete iter->second;
+        functions.erase(iter);
+        stream->kept.pop_front();
+    }
+    irRecycleCode();
+}
+
+void irStreamOptimizer(IRStream* stream) {
+    while (true) {
+        std::unique_lock<std::mutex> lock(stream->mutex);
+        stream->queued.wait(lock, [stream] { return stream->done || !stream->queue.empty(); });
+        if (stream->queue.empty()) {
+            break;
+        }
+        Code* fundec = stream->queue.front();
+        stream->queue.pop_front();
+        stream->storage.insert(stream->storage.end(), code_free_list.begin(), code_free_list.end());
+        code_free_list.clear();
+        lock.unlock();
+        stream->taken.notify_one();
+        irStreamFunction(stream, fundec);
+    }
+    for (auto& iter : functions) {
+        irFreeCode(iter.second->fundec);
+        delete iter.second;
+    }
+    functions.clear();
+    value_pool.clear();
+    constant_values.clear();
+    irReleaseCodeStorage();
+}
+
+IRStream* irStreamStart(FILE* out, bool bulk_memory, bool vectorize) {
+    IRStream* stream = new IRStream();
+    stream->out = out;
+    stream->bulk_memory = bulk_memory;
+    stream->vectorize = vectorize;
+    stream->optimizer = std::thread(irStreamOptimizer, stream);
+    return stream;
+}
+
+void irStreamPush(IRStream* stream, Code* fundec) {
+    std::unique_lock<std::mutex> lock(stream->mutex);
+    stream->taken.wait(lock, [stream] { return stream->queue.size() < STREAM_QUEUE_LIMIT; });
+    stream->queue.push_back(fundec);
+    code_free_list.insert(code_free_list.end(), stream->storage.begin(), stream->storage.end());
+    stream->storage.clear();
+    lock.unlock();
+    stream->queued.notify_one();
+}
+
+// wait until every queued function is printed
+void irStreamFinish(IRStream* stream) {
+    {
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        stream->done = true;
+    }
+    stream->queued.notify_one();
+    stream->optimizer.join();
+    code_free_list.insert(code_free_list.end(), stream->storage.begin(), stream->storage.end());
+    delete stream;
+}
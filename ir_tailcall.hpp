@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "ir.hpp"
+#include "ir_cfg.hpp"
+#include "ir_codegen.hpp"
+#include "ir_optimizer.hpp"
+
+struct TailCallSite {
+    std::vector<Code*> args; // in ARG order, i.e. last parameter first
+
+    Code* call;
+
+    Code* accumulate = nullptr; // y := x op CALL result, for accumulator recursion
+
+    Code* ret;
+};
+
+Value* irAccumulateOperand(Code* accumulate, Value* result) {
+    return accumulate->arg1 == result ? accumulate->arg2 : accumulate->arg1;
+}
+
+bool irFindTailCall(Code* call, const std::string& name, int paramCount, TailCallSite& site) {
+    if (call->opcode != IR_CALL || call->arg1->to_string() != name) {
+        return false;
+    }
+    site.args.clear();
+    for (Code* arg = call->prev; arg && arg->opcode == IR_ARG && site.args.size() < paramCount; arg = arg->prev) {
+        site.args.insert(site.args.begin(), arg);
+    }
+    if (site.args.size() != paramCount) {
+        return false;
+    }
+    site.call = call;
+    site.accumulate = nullptr;
+    Code* next = call->next;
+    if (next && (next->opcode == IR_ADD || next->opcode == IR_MUL) && (next->arg1 == call->result) != (next->arg2 == call->result)) {
+        site.accumulate = next;
+        next = next->next;
+    }
+    Value* value = site.accumulate ? site.accumulate->result : call->result;
+    if (!next || next->opcode != IR_RETURN || next->result != value) {
+        return false;
+    }
+    site.ret = next;
+    return true;
+}
+
+// rewrite self tail calls into parameter reassignment plus a jump back to the
+// entry; "return x op f(...)" with op in {+, *} is made tail recursive first
+// by threading an accumulator through the loop
+void irTailCallFunction(Code* fundec) {
+    std::string name = fundec->result->to_string();
+    std::vector<Value*> params;
+    Code* entry = fundec;
+    while (entry->next && entry->next->opcode == IR_PARAM) {
+        entry = entry->next;
+        params.push_back(entry->result);
+    }
+
+    std::vector<TailCallSite> sites;
+    IROpCode accumulateOp = IR_NOP;
+    for (Code* code = entry->next; code && code->opcode != IR_FUNDEC; code = code->next) {
+        TailCallSite site;
+        if (!irFindTailCall(code, name, params.size(), site)) {
+            continue;
+        }
+        if (site.accumulate) {
+            if (accumulateOp != IR_NOP && accumulateOp != site.accumulate->opcode) {
+                continue;
+            }
+            accumulateOp = site.accumulate->opcode;
+        }
+        sites.push_back(site);
+    }
+    if (sites.empty()) {
+        return;
+    }
+
+    Value* acc = nullptr;
+    if (accumulateOp != IR_NOP) {
+        acc = makeTemp();
+        irInsertAfter(entry, new Code(IR_MOVE, makeCV(accumulateOp == IR_ADD ? 0 : 1), acc));
+        entry = entry->next;
+        for (Code* code = entry->next; code && code->opcode != IR_FUNDEC; code = code->next) {
+            if (code->opcode != IR_RETURN) continue;
+            bool tail = false;
+            for (const TailCallSite& site : sites) {
+                tail = tail || site.ret == code;
+            }
+            if (!tail) {
+                Value* t = makeTemp();
+                irInsertAfter(code->prev, new Code(accumulateOp, acc, code->result, t));
+                code->result = t;
+            }
+        }
+    }
+    Value* label = makeLabel();
+    irInsertAfter(entry, new Code(IR_LABEL, label));
+
+    for (const TailCallSite& site : sites) {
+        Code* pos = site.ret->prev;
+        if (site.accumulate) {
+            Value* x = irAccumulateOperand(site.accumulate, site.call->result);
+            pos = irInsertAfter(pos, new Code(accumulateOp, acc, x, acc));
+        }
+        // parallel assignment: arguments naming another parameter are copied first
+        std::vector<Value*> values(params.size());
+        for (int i = 0; i < params.size(); i++) {
+            values[i] = site.args[params.size() - i - 1]->result;
+        }
+        for (int i = 0; i < params.size(); i++) {
+            if (values[i] != params[i] && std::find(params.begin(), params.end(), values[i]) != params.end()) {
+                Value* t = makeTemp();
+                pos = irInsertAfter(pos, new Code(IR_MOVE, values[i], t));
+                values[i] = t;
+            }
+        }
+        for (int i = 0; i < params.size(); i++) {
+            if (values[i] != params[i]) {
+                pos = irInsertAfter(pos, new Code(IR_MOVE, values[i], params[i]));
+            }
+        }
+        irInsertAfter(pos, new Code(IR_GOTO, label));
+        for (Code* arg : site.args) {
+            disableInst(arg);
+        }
+        disableInst(site.call);
+        if (site.accumulate) {
+            disableInst(site.accumulate);
+        }
+        disableInst(site.ret);
+    }
+}
+
+void irTailCallOpt(Code* code) {
+    irFixPrev(code);
+    for (Code* fundec : irFindFunctionHeads(code)) {
+        irTailCallFunction(fundec);
+    }
+}
@@ -0,0 +1,457 @@
+#pragma once
+
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "ast.h"
+#include "ir.hpp"
+#include "ir_cfg.hpp"
+#include "ir_codegen.hpp"
+#include "ir_optimizer.hpp"
+
+#define VECTOR_LANES 4 // words per vector operation, at most VECTOR_MAX_LANES
+
+// a scalar the loop body computes as constant + the terms + stride times the
+// induction variable, plus the address of base if it has one
+struct IRAffine {
+    Value* base = nullptr;
+
+    std::map<Value*, int> terms; // loop invariant values, by coefficient
+
+    int constant = 0;
+
+    int stride = 0;
+
+    bool operator==(const IRAffine& other) const {
+        return base == other.base && terms == other.terms && constant == other.constant && stride == other.stride;
+    }
+};
+
+// an innermost loop as irBlockLayout leaves it, entered at head or at cond:
+//     LABEL head :  body  iv := iv + #1  [LABEL cond :]  IF iv < bound GOTO head
+struct IRVectorLoop {
+    Code* head;
+
+    Code* step;
+
+    Code* cond = nullptr;
+
+    Code* branch;
+
+    Value* iv;
+
+    Value* bound;
+
+    IROpCode relop; // IR_LT or IR_LE
+};
+
+// what the loops of a function share, and the loop being vectorized
+struct IRVectorState {
+    std::unordered_set<Value*> arrays; // DEC'd in the function
+
+    std::unordered_map<Value*, Value*> addresses; // set only once, to the address of an array
+
+    std::unordered_map<Value*, int> mentions; // uses and definitions in the function
+
+    std::unordered_map<Value*, Code*> labels;
+
+    std::unordered_map<Value*, int> jumps; // to each label
+
+    std::vector<Code*> branches; // each may close a loop
+
+    IRVectorLoop loop;
+
+    std::unordered_map<Value*, IRAffine> scalars; // still computed by scalar code, for the first lane
+
+    std::unordered_map<Value*, Value*> vectors; // computed for all lanes at once, by the vector holding them
+
+    std::unordered_map<Value*, Value*> steps; // affine scalars spread over the lanes
+
+    std::vector<std::pair<IRAffine, bool>> accesses; // words read, or written if true, by the first lane
+
+    Code *head = nullptr, *tail = nullptr; // the vector body
+};
+
+bool irAffineIsConstant(const IRAffine& affine) {
+    return !affine.base && affine.terms.empty() && !affine.stride;
+}
+
+// a + sign * b, unless that adds two addresses or subtracts one
+bool irAffineAdd(const IRAffine& a, const IRAffine& b, int sign, IRAffine& sum) {
+    if (b.base && (a.base || sign < 0)) {
+        return false;
+    }
+    sum = a;
+    sum.base = a.base ? a.base : b.base;
+    for (auto& term : b.terms) {
+        int& coefficient = sum.terms[term.first];
+        coefficient += sign * term.second;
+        if (!coefficient) sum.terms.erase(term.first);
+    }
+    sum.constant += sign * b.constant;
+    sum.stride += sign * b.stride;
+    return true;
+}
+
+// a * b, if one of them is a constant and the other no address
+bool irAffineScale(const IRAffine& a, const IRAffine& b, IRAffine& product) {
+    const IRAffine* scaled = irAffineIsConstant(b) ? &a : &b;
+    const IRAffine* factor = irAffineIsConstant(b) ? &b : &a;
+    if (!irAffineIsConstant(*factor) || scaled->base) {
+        return false;
+    }
+    int k = factor->constant;
+    product = IRAffine();
+    for (auto& term : scaled->terms) {
+        if (k) product.terms[term.first] = k * term.second;
+    }
+    product.constant = k * scaled->constant;
+    product.stride = k * scaled->stride;
+    return true;
+}
+
+IRAffine irAffineOf(IRVectorState& state, Value* value) {
+    IRAffine affine;
+    auto iter = state.scalars.find(value);
+    auto address = state.addresses.find(value);
+    if (isConstant(value)) {
+        affine.constant = value->val;
+    } else if (value == state.loop.iv) {
+        affine.stride = 1;
+    } else if (iter != state.scalars.end()) {
+        affine = iter->second;
+    } else if (address != state.addresses.end()) {
+        affine.base = address->second;
+    } else {
+        affine.terms[value] = 1;
+    }
+    return affine;
+}
+
+// records what an ADD, MINUS or MUL of scalars computes, unless it varies
+// over the iterations other than affinely
+bool irAffineAssign(IRVectorState& state, Code* code) {
+    IRAffine a = irAffineOf(state, code->arg1), b = irAffineOf(state, code->arg2);
+    IRAffine& affine = state.scalars[code->result];
+    bool folded = code->opcode == IR_MUL ? irAffineScale(a, b, affine) : irAffineAdd(a, b, code->opcode == IR_ADD ? 1 : -1, affine);
+    if (folded) {
+        return true;
+    } else if (!a.stride && !b.stride && !a.base && !b.base) {
+        affine = IRAffine(); // invariant, but not affine
+        affine.terms[code->result] = 1;
+        return true;
+    }
+    state.scalars.erase(code->result);
+    return false;
+}
+
+void irVectorEmit(IRVectorState& state, Code* code) {
+    appendCode(state.head, state.tail, code);
+}
+
+Code* irVectorCode(IROpCode opcode, Value* arg1, Value* arg2, Value* result) {
+    Code* code = new Code(opcode, arg1, arg2, result);
+    code->size = VECTOR_LANES;
+    return code;
+}
+
+// a value as an operand of a vector operation: a vector, or a scalar that
+// is the same in every lane
+Value* irVectorOperand(IRVectorState& state, Value* value) {
+    auto vector = state.vectors.find(value);
+    if (vector != state.vectors.end()) {
+        return vector->second;
+    }
+    IRAffine affine = irAffineOf(state, value);
+    if (!affine.stride) {
+        return value;
+    }
+    Value*& step = state.steps[value];
+    if (!step) {
+        step = makeTemp();
+        irVectorEmit(state, irVectorCode(IR_VSTEP, value, makeCV(affine.stride), step));
+    }
+    return step;
+}
+
+// the address of a load or store one word further each iteration, or the
+// same word every iteration if it may stay scalar
+bool irVectorAddress(IRVectorState& state, Value* address, bool scalar, bool write) {
+    if (state.vectors.count(address)) {
+        return false;
+    }
+    IRAffine affine = irAffineOf(state, address);
+    if (!affine.base || !(affine.stride == 4 || (scalar && affine.stride == 0))) {
+        return false;
+    }
+    state.accesses.push_back({ affine, write });
+    return true;
+}
+
+// each iteration may only touch a word another iteration writes if it is
+// the same word, so iterations never depend on each other; a loop that
+// writes nothing is not worth changing
+bool irVectorIndependent(IRVectorState& state) {
+    bool written = false;
+    for (auto& write : state.accesses) {
+        if (!write.second) continue;
+        written = true;
+        for (auto& access : state.accesses) {
+            if (access.first.base == write.first.base && !(access.first == write.first)) {
+                return false;
+            }
+        }
+    }
+    return written;
+}
+
+// the body of one vector iteration, doing VECTOR_LANES scalar iterations:
+// scalars that stay affine keep their code and hold the first lane, the
+// rest become vector operations
+bool irVectorizeBody(IRVectorState& state) {
+    for (Code* code = state.loop.head->next; code != state.loop.step; code = code->next) {
+        Value* result = code->result;
+        switch (code->opcode) {
+            case IR_LOADADDR:
+                if (!state.arrays.count(code->arg1)) {
+                    return false;
+                }
+                state.scalars[result].base = code->arg1;
+                break;
+            case IR_MOVE: {
+                auto vector = state.vectors.find(code->arg1);
+                if (vector != state.vectors.end()) {
+                    state.vectors[result] = vector->second;
+                    continue;
+                }
+                state.scalars[result] = irAffineOf(state, code->arg1);
+                break;
+            }
+            case IR_ADD:
+            case IR_MINUS:
+            case IR_MUL: {
+                if (!state.vectors.count(code->arg1) && !state.vectors.count(code->arg2) && irAffineAssign(state, code)) {
+                    break;
+                }
+                IROpCode opcode = code->opcode == IR_ADD ? IR_VADD : code->opcode == IR_MINUS ? IR_VMINUS : IR_VMUL;
+                Value *arg1 = irVectorOperand(state, code->arg1), *arg2 = irVectorOperand(state, code->arg2);
+                Value*& vector = state.vectors[result];
+                vector = makeTemp();
+                irVectorEmit(state, irVectorCode(opcode, arg1, arg2, vector));
+                continue;
+            }
+            case IR_LOAD: {
+                if (!irVectorAddress(state, code->arg1, true, false)) {
+                    return false;
+                }
+                if (!state.accesses.back().first.stride) {
+                    state.scalars[result].terms[result] = 1;
+                    break;
+                }
+                Value*& vector = state.vectors[result];
+                vector = makeTemp();
+                irVectorEmit(state, irVectorCode(IR_VLOAD, code->arg1, nullptr, vector));
+                continue;
+            }
+            case IR_STORE: {
+                if (!irVectorAddress(state, result, false, true)) {
+                    return false;
+                }
+                irVectorEmit(state, irVectorCode(IR_VSTORE, irVectorOperand(state, code->arg1), nullptr, result));
+                continue;
+            }
+            default:
+                return false;
+        }
+        Code* copy = new Code(code->opcode, code->arg1, code->arg2, result);
+        irVectorEmit(state, copy);
+    }
+    return irVectorIndependent(state);
+}
+
+void irVectorScan(IRVectorState& state, Code* fundec) {
+    std::unordered_map<Value*, int> defs;
+    for (Code* code = fundec->next; code && code->opcode != IR_FUNDEC; code = code->next) {
+        if (code->opcode == IR_ALLOC) {
+            state.arrays.insert(code->result);
+        } else if (code->opcode == IR_LABEL) {
+            state.labels[code->result] = code;
+        } else if (code->opcode == IR_GOTO || code->opcode == IR_IFGOTO) {
+            state.jumps[code->result]++;
+        }
+        if (code->opcode == IR_IFGOTO) {
+            state.branches.push_back(code);
+        }
+        if (irIsAssign(code->opcode)) {
+            defs[code->result]++;
+        }
+        for (Value* value : { code->arg1, code->arg2, code->result }) {
+            if (value) state.mentions[value]++;
+        }
+    }
+    for (Code* code = fundec->next; code && code->opcode != IR_FUNDEC; code = code->next) {
+        if (code->opcode == IR_LOADADDR && defs[code->result] == 1 && state.arrays.count(code->arg1)) {
+            state.addresses[code->result] = code->arg1;
+        }
+    }
+}
+
+// drop what was found about the last loop, and its code if not used
+void irVectorReset(IRVectorState& state) {
+    while (state.head) {
+        Code* next = state.head->next;
+        delete state.head;
+        state.head = next;
+    }
+    state.tail = nullptr;
+    state.scalars.clear();
+    state.vectors.clear();
+    state.steps.clear();
+    state.accesses.clear();
+}
+
+// the loop branch closes, if it has the form IRVectorLoop describes
+bool irMatchVectorLoop(IRVectorState& state, Code* branch) {
+    irVectorReset(state);
+    IRVectorLoop& loop = state.loop = IRVectorLoop();
+    auto iter = state.labels.find(branch->result);
+    if (iter == state.labels.end() || state.jumps[branch->result] != 1) {
+        return false;
+    }
+    loop.head = iter->second;
+    loop.branch = branch;
+    loop.step = branch->prev;
+    if (loop.step->opcode == IR_LABEL) {
+        loop.cond = loop.step;
+        loop.step = loop.step->prev;
+    }
+    Code* step = loop.step;
+    if (step->opcode != IR_ADD || step->arg1 != step->result || !isConstant(step->arg2, 1)) {
+        return false;
+    }
+    loop.iv = step->result;
+    if (branch->arg1 == loop.iv && (branch->relop == IR_LT || branch->relop == IR_LE)) {
+        loop.bound = branch->arg2;
+        loop.relop = branch->relop;
+    } else if (branch->arg2 == loop.iv && (branch->relop == IR_GT || branch->relop == IR_GE)) {
+        loop.bound = branch->arg1;
+        loop.relop = branch->relop == IR_GT ? IR_LT : IR_LE;
+    } else {
+        return false;
+    }
+    if (loop.bound == loop.iv) {
+        return false;
+    }
+    for (Code* code = loop.head->next; code != step; code = code->next) {
+        if (!code || code->opcode == IR_LABEL || code->opcode == IR_FUNDEC || irIsTerminator(code->opcode)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// each value the body sets is set once, before any use in the body, and
+// never used outside it, so the vector and scalar loops may compute it
+// differently
+bool irVectorValuesLocal(IRVectorState& state) {
+    IRVectorLoop& loop = state.loop;
+    std::unordered_set<Value*> defined;
+    std::unordered_map<Value*, int> inside;
+    for (Code* code = loop.head->next; code != loop.step; code = code->next) {
+        if (irIsAssign(code->opcode)) {
+            if (code->result == loop.iv || code->result == loop.bound || !defined.insert(code->result).second) {
+                return false;
+            }
+        }
+    }
+    for (Code* code = loop.head->next; code != loop.step; code = code->next) {
+        for (Value* value : { code->arg1, code->arg2, code->result }) {
+            if (defined.count(value)) inside[value]++;
+        }
+    }
+    std::unordered_set<Value*> seen;
+    for (Code* code = loop.head->next; code != loop.step; code = code->next) {
+        for (Value* value : { code->arg1, code->arg2 }) {
+            if (defined.count(value) && !seen.count(value)) return false;
+        }
+        if (code->opcode == IR_STORE && defined.count(code->result) && !seen.count(code->result)) {
+            return false;
+        }
+        if (irIsAssign(code->opcode)) {
+            seen.insert(code->result);
+        }
+    }
+    for (auto& iter : inside) {
+        if (state.mentions[iter.first] != iter.second) return false;
+    }
+    return true;
+}
+
+// run VECTOR_LANES iterations at a time while that many remain, then the
+// original loop for the rest:
+//     [last := iv + #3;  IF last >= bound GOTO head]     if head is fallen into
+//     LABEL vector :  vector body  iv := iv + #4
+//     [LABEL cond :]  last := iv + #3;  IF last < bound GOTO vector;  GOTO rest
+//     LABEL head :  body  iv := iv + #1
+//     LABEL rest :  IF iv < bound GOTO head
+void irVectorizeLoop(IRVectorState& state) {
+    IRVectorLoop& loop = state.loop;
+    Value *vector = makeLabel(), *rest = makeLabel(), *last = makeTemp();
+    Code* pos = loop.head->prev;
+    Code *head = nullptr, *tail = nullptr;
+    if (pos->opcode != IR_GOTO && pos->opcode != IR_RETURN) {
+        appendCode(head, tail, new Code(IR_ADD, loop.iv, makeCV(VECTOR_LANES - 1), last));
+        appendCode(head, tail, new Code(IR_IFGOTO, last, loop.bound, loop.head->result, rev_relop(loop.relop)));
+    }
+    appendCode(head, tail, new Code(IR_LABEL, vector));
+    appendCode(head, tail, state.head);
+    appendCode(head, tail, new Code(IR_ADD, loop.iv, makeCV(VECTOR_LANES), loop.iv));
+    if (loop.cond) {
+        irUnlink(loop.cond);
+        loop.cond->next = nullptr;
+        appendCode(head, tail, loop.cond);
+    }
+    appendCode(head, tail, new Code(IR_ADD, loop.iv, makeCV(VECTOR_LANES - 1), last));
+    appendCode(head, tail, new Code(IR_IFGOTO, last, loop.bound, vector, loop.relop));
+    appendCode(head, tail, new Code(IR_GOTO, rest));
+
+    head->prev = pos;
+    tail->next = loop.head;
+    pos->next = head;
+    loop.head->prev = tail;
+    irInsertAfter(loop.step, new Code(IR_LABEL, rest));
+    state.head = state.tail = nullptr;
+}
+
+void irVectorizeFunction(Code* fundec) {
+    IRVectorState state;
+    irVectorScan(state, fundec);
+    for (Code* branch : state.branches) {
+        if (!irMatchVectorLoop(state, branch)) {
+            continue;
+        }
+        IRVectorLoop& loop = state.loop;
+        // too few iterations to fill a vector once
+        if (isConstant(loop.bound) && loop.bound->val - (loop.relop == IR_LT) < VECTOR_LANES - 1) {
+            continue;
+        }
+        if (irVectorValuesLocal(state) && irVectorizeBody(state)) {
+            irVectorizeLoop(state);
+        }
+    }
+    irVectorReset(state);
+}
+
+// loops over DEC'd arrays whose iterations are independent run several
+// iterations per vector operation. The output is only accepted by
+// simulators that know the vector opcodes, so this runs on request only,
+// after the other passes
+void irVectorizeOpt(Code* code) {
+    irFixPrev(code);
+    for (Code* fundec : irFindFunctionHeads(code)) {
+        irVectorizeFunction(fundec);
+    }
+}
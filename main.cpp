@@ -0,0 +1,87 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "batch.hpp"
+#include "splc.h"
+
+SplcOptions options;
+
+// batch worker: compile one input into the .ir file next to it
+int compileToFile(const char* path) {
+    SplcResult result = splcCompileFile(path, options);
+    fputs(result.report.c_str(), stderr);
+    if (result.status < 0) {
+        fputs(result.output.c_str(), stderr);
+        return -1;
+    }
+    std::string output = batchOutputPath(path);
+    FILE* file = fopen(output.c_str(), "w");
+    if (!file) {
+        perror(output.c_str());
+        return -1;
+    }
+    fwrite(result.output.data(), 1, result.output.size(), file);
+    fclose(file);
+    return result.status;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> paths;
+    int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    bool usage = false;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--profile-generate") && i + 1 < argc) {
+            options.profile_generate = argv[++i];
+        } else if (!strcmp(argv[i], "--profile-use") && i + 1 < argc) {
+            options.profile_use = argv[++i];
+        } else if (!strcmp(argv[i], "--include-cache") && i + 1 < argc) {
+            options.include_cache = argv[++i];
+        } else if (!strcmp(argv[i], "--mem-report")) {
+            options.mem_report = true;
+        } else if (!strcmp(argv[i], "--bulk-memory")) {
+            options.bulk_memory = true;
+        } else if (!strcmp(argv[i], "--vectorize")) {
+            options.vectorize = true;
+        } else if (!strcmp(argv[i], "--stream")) {
+            options.stream = stdout;
+        } else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (argv[i][0] != '-') {
+            paths.push_back(argv[i]);
+        } else {
+            usage = true;
+        }
+    }
+    struct stat info;
+    bool batch = paths.size() > 1 || (paths.size() == 1 && stat(paths[0].c_str(), &info) == 0 && S_ISDIR(info.st_mode));
+    if (usage || paths.empty() || jobs < 1 || (batch && (options.profile_generate || options.profile_use || options.stream))
+            || (options.stream && (options.profile_generate || options.profile_use))) {
+        fprintf(stderr, "Usage: %s [--include-cache <dir>] [--mem-report] [--bulk-memory] [--vectorize] [--stream | --profile-generate <profile> | --profile-use <profile>] <file_path>\n", argv[0]);
+        fprintf(stderr, "       %s [--include-cache <dir>] [--mem-report] [--bulk-memory] [--vectorize] [-j <jobs>] <file_or_directory>...\n", argv[0]);
+        exit(-1);
+    }
+    if (!batch) {
+        SplcResult result = splcCompileFile(paths[0].c_str(), options);
+        fputs(result.report.c_str(), stderr);
+        fwrite(result.output.data(), 1, result.output.size(), result.status < 0 ? stderr : stdout);
+        if (result.status < 0) {
+            exit(-1);
+        }
+        return 0;
+    }
+    std::vector<std::string> inputs;
+    bool found = true;
+    for (const std::string& path : paths) {
+        found &= batchCollectInputs(path, inputs);
+    }
+    if (!found || inputs.empty()) {
+        exit(-1);
+    }
+    return batchCompile(inputs, jobs, compileToFile) ? 1 : 0;
+}
@@ -1,93 +1,185 @@
 #include "semantic.hpp"
 #include <algorithm>
+#include <cstdint>
+#include <deque>
 #include <unordered_map>
-#include <functional>
 #include <string>
 #include <vector>
 
+// checker state lives in thread_local globals like the IR state, reset
+// by semanticReset so every translation unit starts fresh
+thread_local std::deque<Type> type_pool;
 
-bool Symbol::structual_equivalent(const Symbol& other) {
-        std::vector<ExprType> this_members, other_members;
-        for (const auto& member : members) {
-            this_members.push_back(ExprType(false, member.type));
-        }
-        for (const auto& member : other.members) {
-            other_members.push_back(ExprType(false, member.type));
-        }
-        return this_members == other_members;
+thread_local std::unordered_map<uint64_t, const Type*> array_types; // element id and length
+
+thread_local std::unordered_map<uint64_t, bool> struct_equivalence; // memoized per pair of struct ids
+
+thread_local FILE* semantic_out = stdout;
+
+thread_local int semantic_errors = 0;
+
+// never change, so every thread shares them
+const Type primitive_types[3] = { { PRIMITIVE_TYPE, 0, TYPE_INT }, { PRIMITIVE_TYPE, 1, TYPE_FLOAT }, { PRIMITIVE_TYPE, 2, TYPE_CHAR } };
+
+Type* make_type(TypeKind kind) {
+    type_pool.push_back(Type());
+    Type* type = &type_pool.back();
+    type->kind = kind;
+    type->id = 3 + type_pool.size() - 1; // after the primitives
+    return type;
+}
+
+const Type* primitive_type(int primitive) {
+    return &primitive_types[primitive];
+}
+
+const Type* array_type(const Type* element, int length) {
+    const Type*& type = array_types[(uint64_t) element->id << 32 | (uint32_t) length];
+    if (!type) {
+        Type* array = make_type(ARRAY_TYPE);
+        array->element = element;
+        array->length = length;
+        type = array;
+    }
+    return type;
+}
+
+// a fresh node for every struct definition, equal to others only structurally
+const Type* struct_type(Symbol* structdef) {
+    Type* type = make_type(STRUCT_TYPE);
+    type->structdef = structdef;
+    return type;
+}
+
+std::string Type::to_string() const {
+    switch (kind) {
+        case PRIMITIVE_TYPE: return typeName(primitive);
+        case ARRAY_TYPE: return element->to_string() + "[" + std::to_string(length) + "]";
+        default: return "struct " + structdef->name;
+    }
+}
+
+// two struct types are equivalent when their members are pairwise; a pair
+// is assumed equivalent while it is being compared so cycles terminate
+bool type_equivalent(const Type* a, const Type* b) {
+    if (a == b) {
+        return true;
+    }
+    if (a->kind != STRUCT_TYPE || b->kind != STRUCT_TYPE) {
+        return false;
+    }
+    uint64_t key = (uint64_t) std::min(a->id, b->id) << 32 | std::max(a->id, b->id);
+    auto iter = struct_equivalence.find(key);
+    if (iter != struct_equivalence.end()) {
+        return iter->second;
+    }
+    struct_equivalence[key] = true;
+    const std::vector<Symbol>& members = a->structdef->members;
+    const std::vector<Symbol>& others = b->structdef->members;
+    bool equivalent = members.size() == others.size();
+    for (int i = 0; equivalent && i < members.size(); i++) {
+        equivalent = members[i].type && others[i].type ? type_equivalent(members[i].type, others[i].type) : members[i].type == others[i].type;
+    }
+    struct_equivalence[key] = equivalent;
+    return equivalent;
+}
+
+// every identifier has a stack of the symbols it names, innermost last;
+// a scope logs the atoms it binds so popping it undoes exactly those
+struct SymbolBinding {
+    Symbol* symbol;
+    int depth;
 };
 
-std::unordered_map<int, std::function<void(AST*)>> handler_map;
+thread_local std::deque<Symbol> symbol_pool;
+
+thread_local std::deque<Symbol> local_symbols; // one per entry of symbol_undo, dropped with it
+
+thread_local std::vector<std::vector<SymbolBinding>> symbol_bindings;
+
+thread_local std::vector<int> symbol_undo;
 
-std::vector<std::unordered_map<std::string, Symbol>> symbol_table { { } };
+thread_local std::vector<size_t> symbol_scopes;
 
-std::string current_scope;
+thread_local Symbol* current_function = nullptr;
 
 void symbol_push_stack() {
-    symbol_table.emplace_back();
+    symbol_scopes.push_back(symbol_undo.size());
     stack_depth++;
 }
 
 void symbol_pop_stack() {
-    symbol_table.pop_back();
+    while (symbol_undo.size() > symbol_scopes.back()) {
+        symbol_bindings[symbol_undo.back()].pop_back();
+        symbol_undo.pop_back();
+        local_symbols.pop_back();
+    }
+    symbol_scopes.pop_back();
     stack_depth--;
 }
 
-std::string pop_array_bracket(std::string specifier) {
-    int begin = specifier.find('['), end = specifier.find(']', begin);
-    return begin == std::string::npos ? specifier : specifier.erase(begin, end - begin + 1);
+std::vector<SymbolBinding>& symbol_stack(int atom) {
+    if (atom >= symbol_bindings.size()) {
+        symbol_bindings.resize(atomCount());
+    }
+    return symbol_bindings[atom];
 }
 
 void semantic_error(int err_type, int lineno, const char* msg) {
-    printf("Error type %d at Line %d: %s\n", err_type, lineno, msg);
+    fprintf(semantic_out, "Error type %d at Line %d: %s\n", err_type, lineno, msg);
+    semantic_errors++;
 };
 
-Symbol* check_symbol(const std::string& name, int depth) {
-    const auto& iter = symbol_table[depth].find(name);
-    if (iter != symbol_table[depth].end()) {
-        return &iter->second;
-    } else if (depth > 0) {
-        return check_symbol(name, depth - 1);
-    } else {
-        return nullptr;
-    }
+Symbol* check_symbol(int atom) {
+    std::vector<SymbolBinding>& stack = symbol_stack(atom);
+    return stack.empty() ? nullptr : stack.back().symbol;
 }
 
-Symbol* check_variable(const std::string& name, int lineno) {
-    Symbol* ptr = check_symbol(name);
+Symbol* check_variable(int atom, int lineno) {
+    Symbol* ptr = check_symbol(atom);
     if (!ptr) {
         semantic_error(1, lineno, "variable is used without definition");
     }
     return ptr;
 }
 
-Symbol* check_struct(const std::string& name, int lineno) {
-    Symbol* ptr = check_symbol(name);
+Symbol* check_struct(int atom, int lineno) {
+    Symbol* ptr = check_symbol(atom);
     if (!ptr) {
         semantic_error(16, lineno, "struct is used without definition");
     }
     return ptr;
 }
 
-Symbol* check_function(const std::string& name, int lineno) {
-    Symbol* ptr = check_symbol(name);
+Symbol* check_function(int atom, int lineno) {
+    Symbol* ptr = check_symbol(atom);
     if (!ptr) {
         semantic_error(2, lineno, "function is invoked without definition");
     }
     return ptr;
 }
 
-bool insert_symbol(Symbol& symbol, int lineno, int depth = stack_depth) {
+// structs and functions are global: they go under any local bindings of
+// the same name and are never undone
+Symbol* insert_symbol(const Symbol& symbol, int lineno) {
     bool isVariable = symbol.symbol_type == VARIABLE;
     bool isFunction = symbol.symbol_type == FUNCTION;
-    auto& table = symbol_table[isVariable ? depth : 0];
-    if (table.find(symbol.name) != table.end()) {
+    int depth = isVariable ? stack_depth : 0;
+    std::vector<SymbolBinding>& stack = symbol_stack(symbol.atom);
+    bool redefined = isVariable ? !stack.empty() && stack.back().depth == depth : !stack.empty() && stack.front().depth == 0;
+    if (redefined) {
         semantic_error(isVariable ? 3 : (isFunction ? 4 : 15), lineno, isVariable ? "variable is redefined in the same scope" : (isFunction ? "function is redefined in the global scope" : "struct is redefined in the global scope"));
-        return false;
+        return nullptr;
+    }
+    std::deque<Symbol>& pool = depth == 0 ? symbol_pool : local_symbols;
+    pool.push_back(symbol);
+    if (depth == 0) {
+        stack.insert(stack.begin(), { &pool.back(), 0 });
     } else {
-        table[symbol.name] = symbol;
-        return true;
+        stack.push_back({ &pool.back(), depth });
+        symbol_undo.push_back(symbol.atom);
     }
+    return &pool.back();
 }
 
 void visitNode(AST* ast);
@@ -98,76 +190,74 @@ void visitChildren(AST* ast) {
     }
 }
 
-void visitNode(AST* ast) {
-    if (ast) {
-        auto handler = handler_map.find(ast->op);
-        if (handler != handler_map.end()) {
-            handler->second(ast);
-        } else {
-            visitChildren(ast);
-        }
-    }
-}
+std::vector<Symbol> visitDecList(const Type* specifier, AST* ast);
 
-std::vector<Symbol> visitDecList(std::string specifier, AST* ast);
-
-std::string symbol_from_specifier(AST* ast);
+const Type* symbol_from_specifier(AST* ast);
 
 std::vector<Symbol> visitStructSpecifierDef(AST* ast) {
-    std::string specifier = symbol_from_specifier(ast->children[0]);
+    const Type* specifier = symbol_from_specifier(ast->children[0]);
     return visitDecList(specifier, ast->children[1]);
 }
 
 std::vector<Symbol> visitStructSpecifierDefList(AST* ast) {
-    if (!ast) {
-        return {};
+    std::vector<Symbol> vec;
+    for (int i = 0; ast && i < ast->num_children; i++) {
+        auto members = visitStructSpecifierDef(ast->children[i]);
+        vec.insert(vec.end(), members.begin(), members.end());
     }
-    auto vec = visitStructSpecifierDef(ast->children[0]);
-    auto vec2 = visitStructSpecifierDefList(ast->children[1]);
-    vec.insert(vec.end(), vec2.begin(), vec2.end());
     return vec;
 }
 
 void visitStructSpecifier(AST* ast) { // dirty hacks :(
     if (ast->num_children >= 4) { // STRUCT ID LC (DefList) RC
-        Symbol symbol(STRUCTDEF, ast->children[1]->str);
-        if (insert_symbol(symbol, ast->lineno) && ast->num_children == 5) { // STRUCT ID LC DefList RC
-            symbol_table[0][symbol.name].members = visitStructSpecifierDefList(ast->children[3]);
+        Symbol* symbol = insert_symbol(Symbol(STRUCTDEF, ast->children[1]->val), ast->lineno);
+        if (symbol) {
+            symbol->type = struct_type(symbol);
+        }
+        if (symbol && ast->num_children == 5) { // STRUCT ID LC DefList RC
+            symbol->members = visitStructSpecifierDefList(ast->children[3]);
         }
     } else { // STRUCT ID
-        check_struct(ast->children[1]->str, ast->lineno);
+        check_struct(ast->children[1]->val, ast->lineno);
     }
 }
 
-std::string symbol_from_specifier(AST* ast) {
+// nullptr for an undefined struct, which makes every use of it invalid
+const Type* symbol_from_specifier(AST* ast) {
     if (ast->num_children == 0) { // ID
-        return typeName(ast->val);
+        return primitive_type(ast->val);
     } else { // StructSpecifier
         visitStructSpecifier(ast->children[0]);
-        return ast->children[0]->children[1]->str;
+        Symbol* symbol = check_symbol(ast->children[0]->children[1]->val);
+        return symbol && symbol->symbol_type == STRUCTDEF ? symbol->type : nullptr;
     }
 }
 
-Symbol visitVarDec(std::string specifier, AST* ast) {
-    if (ast->num_children == 1) { // ID
-        Symbol symbol(VARIABLE, ast->children[0]->str);
-        symbol.type = specifier;
-        return symbol;
-    } else { // VarDec LB INT RB
-        auto symbol = visitVarDec(specifier, ast->children[0]);
-        symbol.type += "[" + std::to_string(ast->children[2]->val) + "]";
-        return symbol;
+// a[2][3] is an array of 2 arrays of 3, so dimensions wrap from the innermost out
+Symbol visitVarDec(const Type* specifier, AST* ast) {
+    AST* varDec = ast;
+    std::vector<int> dimensions;
+    while (ast->num_children != 1) { // VarDec LB INT RB
+        dimensions.push_back(ast->children[2]->val);
+        ast = ast->children[0];
     }
+    Symbol symbol(VARIABLE, ast->children[0]->val);
+    symbol.type = specifier;
+    for (int i = 0; specifier && i < dimensions.size(); i++) {
+        symbol.type = array_type(symbol.type, dimensions[i]);
+    }
+    varDec->type = symbol.type;
+    return symbol;
 }
 
 ExprType visitExp(AST* ast);
 
-Symbol visitDec(std::string specifier, AST* ast) {
+Symbol visitDec(const Type* specifier, AST* ast) {
     // VarDec or VarDec ASSIGN Exp, don't care, check assign in visitExp
     return visitVarDec(specifier, ast->children[0]);
 }
 
-std::vector<Symbol> visitDecList(std::string specifier, AST* ast) {
+std::vector<Symbol> visitDecList(const Type* specifier, AST* ast) {
     if (ast->num_children == 1) {
         return { visitDec(specifier, ast->children[0]) };
     } else {
@@ -178,7 +268,7 @@ std::vector<Symbol> visitDecList(std::string specifier, AST* ast) {
 }
 
 void visitDef(AST* ast) {
-    std::string specifier = symbol_from_specifier(ast->children[0]);
+    const Type* specifier = symbol_from_specifier(ast->children[0]);
     AST* decList = ast->children[1];
     auto symbols = visitDecList(specifier, decList);
     for (auto& symbol : symbols) {
@@ -187,27 +277,23 @@ void visitDef(AST* ast) {
 }
 
 void visitDefList(AST* ast) {
-    if (ast && ast->num_children > 0) {
-        visitDef(ast->children[0]);
-        visitDefList(ast->children[1]);
+    for (int i = 0; i < ast->num_children; i++) {
+        visitDef(ast->children[i]);
     }
 }
 
 std::vector<ExprType> visitArgs(AST* ast) {
-    if (ast->num_children == 1) { // Exp
-        return { visitExp(ast->children[0]) };
-    } else { // Exp COMMA Args
-        auto vec = visitArgs(ast->children[2]);
-        vec.push_back(visitExp(ast->children[0]));
-        return vec;
+    std::vector<ExprType> vec;
+    for (int i = 0; i < ast->num_children; i++) {
+        vec.push_back(visitExp(ast->children[i]));
     }
+    return vec;
 }
 
-ExprType visitExp(AST* ast) {
-    // TODO: Add other exp
-    if (ast->num_children == 4) {
-        if (ast->children[0]->op == SYMBOL) { // ID LP Args RP
-            Symbol* ptr = check_function(ast->children[0]->str, ast->lineno);
+ExprType checkExp(AST* ast) {
+    switch (ast->prod) {
+        case PROD_EXP_CALL: {
+            Symbol* ptr = check_function(ast->children[0]->val, ast->lineno);
             if (ptr) {
                 if (ptr->symbol_type != FUNCTION) {
                     semantic_error(11, ast->lineno, "invoke function operator on non-function names");
@@ -229,24 +315,26 @@ ExprType visitExp(AST* ast) {
                     }
                 }
             }
-        } else { // Exp LB Exp RB
+            break;
+        }
+        case PROD_EXP_INDEX: {
             ExprType array_type = visitExp(ast->children[0]);
             ExprType index_type = visitExp(ast->children[2]);
             bool success = true;
-            if (array_type.type.find('[') == std::string::npos) {
+            if (!array_type.valid || array_type.type->kind != ARRAY_TYPE) {
                 semantic_error(10, ast->lineno, "indexing on non-array");
                 success = false;
             }
-            if (index_type.type != "int") {
+            if (!index_type.isInt()) {
                 semantic_error(12, ast->lineno, "indexing by non-integer");
                 success = false;
             }
             if (success) {
-                return ExprType(true, pop_array_bracket(array_type.type));
+                return ExprType(true, array_type.type->element);
             }
+            break;
         }
-    } else if (ast->num_children == 3) {
-        if (ast->to_string() == "Exp_ExpASSIGNExp") {
+        case PROD_EXP_ASSIGN: {
             ExprType ltype = visitExp(ast->children[0]);
             ExprType rtype = visitExp(ast->children[2]);
             if (ltype != rtype) {
@@ -256,63 +344,67 @@ ExprType visitExp(AST* ast) {
             } else {
                 return ExprType(false, ltype.type);
             }
-        } else if (ast->children[0]->op == EXP && ast->children[2]->op == EXP) { // Exp(OPR)Exp
+            break;
+        }
+        case PROD_EXP_AND:
+        case PROD_EXP_OR:
+        case PROD_EXP_LT:
+        case PROD_EXP_LE:
+        case PROD_EXP_GT:
+        case PROD_EXP_GE:
+        case PROD_EXP_NE:
+        case PROD_EXP_EQ:
+        case PROD_EXP_PLUS:
+        case PROD_EXP_MINUS:
+        case PROD_EXP_MUL:
+        case PROD_EXP_DIV: {
             ExprType ltype = visitExp(ast->children[0]);
             ExprType rtype = visitExp(ast->children[2]);
             if (ltype != rtype) {
                 semantic_error(7, ast->lineno, "unmatching operands on both sides of operator");
-            } else {
-                if (ltype.valid && rtype.valid) {
-                    switch (ast->children[1]->op) {
-                        case AND_OP:
-                        case OR_OP: // only int can do bool operation
-                            if (!ltype.isInt() || !rtype.isInt()) {
-                                semantic_error(17, ast->lineno, "non-integral boolean operation");
-                            }
-                            break;
-                        case PLUS_OP:
-                        case MINUS_OP:
-                        case MUL_OP:
-                        case DIV_OP:
-                            if (!ltype.isIntOrFloat() || !rtype.isIntOrFloat()) {
-                                semantic_error(18, ast->lineno, "non-numeral arithmetic operation");
-                            }
-                            break;
-                        default:
-                            if (ltype.isChar() || rtype.isChar()) {
-                                semantic_error(19, ast->lineno, "char in binary operation");
-                            }
-                    }
+                break;
+            }
+            if (ltype.valid && rtype.valid) {
+                switch (ast->prod) {
+                    case PROD_EXP_AND:
+                    case PROD_EXP_OR: // only int can do bool operation
+                        if (!ltype.isInt() || !rtype.isInt()) {
+                            semantic_error(17, ast->lineno, "non-integral boolean operation");
+                        }
+                        break;
+                    case PROD_EXP_PLUS:
+                    case PROD_EXP_MINUS:
+                    case PROD_EXP_MUL:
+                    case PROD_EXP_DIV:
+                        if (!ltype.isIntOrFloat() || !rtype.isIntOrFloat()) {
+                            semantic_error(18, ast->lineno, "non-numeral arithmetic operation");
+                        }
+                        break;
+                    default:
+                        if (ltype.isChar() || rtype.isChar()) {
+                            semantic_error(19, ast->lineno, "char in binary operation");
+                        }
                 }
-                return ExprType(false, ltype.type);
             }
-        } else if (ast->to_string() == "Exp_ExpDOTID") {
+            return ExprType(false, ltype.type);
+        }
+        case PROD_EXP_MEMBER: {
             ExprType ltype = visitExp(ast->children[0]);
-            std::string field = ast->children[2]->str;
-            Symbol* ptr = check_variable(ltype.type, ast->lineno);
-            if (ptr) {
-                if (ptr->symbol_type != STRUCTDEF) {
-                    semantic_error(13, ast->lineno, "accessing member of non-struct variables");
-                } else {
-                    auto members = ptr->members;
-                    std::string found_type;
-                    for (auto& member : members) {
-                        if (member.name == field) {
-                            found_type = member.type;
-                            break;
-                        }
-                    }
-                    if (!found_type.empty()) {
-                        return ExprType(true, found_type);
-                    } else {
-                        semantic_error(14, ast->lineno, "accessing an undefined struct member");
+            int field = ast->children[2]->val;
+            if (ltype.valid && ltype.type->kind == STRUCT_TYPE) {
+                for (const Symbol& member : ltype.type->structdef->members) {
+                    if (member.atom == field) {
+                        return ExprType(true, member.type);
                     }
                 }
+                semantic_error(14, ast->lineno, "accessing an undefined struct member");
             } else if (ltype.valid) {
                 semantic_error(13, ast->lineno, "accessing member of non-struct variables");
             }
-        } else if (ast->to_string() == "Exp_IDLPRP") {
-            Symbol* ptr = check_function(ast->children[0]->str, ast->lineno);
+            break;
+        }
+        case PROD_EXP_CALL_EMPTY: {
+            Symbol* ptr = check_function(ast->children[0]->val, ast->lineno);
             if (ptr) {
                 if (ptr->symbol_type != FUNCTION) {
                     semantic_error(11, ast->lineno, "invoking function operator on non-function names");
@@ -322,65 +414,65 @@ ExprType visitExp(AST* ast) {
                     return ExprType(false, ptr->type);
                 }
             }
-        } else if (ast->to_string() == "Exp_LPExpRP") {
-            return visitExp(ast->children[1]);
+            break;
         }
-    } else if (ast->num_children == 2) { // MINUS Exp || NOT Exp
-        ExprType type = visitExp(ast->children[1]);
-        if (type.valid) {
-            switch (ast->children[0]->op) {
-                case NOT_OP: // only int can do bool operation
-                    if (!type.isInt()) {
-                        semantic_error(17, ast->lineno, "non-integral boolean operation");
-                    }
-                    break;
-                case MINUS_OP:
-                    if (!type.isIntOrFloat()) {
-                        semantic_error(18, ast->lineno, "non-numeral arithmetic operation");
-                    }
-                    break;
+        case PROD_EXP_PAREN:
+            return visitExp(ast->children[1]);
+        case PROD_EXP_NEG:
+        case PROD_EXP_NOT: {
+            ExprType type = visitExp(ast->children[1]);
+            if (type.valid) {
+                if (ast->prod == PROD_EXP_NOT && !type.isInt()) { // only int can do bool operation
+                    semantic_error(17, ast->lineno, "non-integral boolean operation");
+                } else if (ast->prod == PROD_EXP_NEG && !type.isIntOrFloat()) {
+                    semantic_error(18, ast->lineno, "non-numeral arithmetic operation");
+                }
             }
+            type.l_value = false;
+            return type;
         }
-        type.l_value = false;
-        return type;
-    } else if (ast->num_children == 1) {
-        if (ast->children[0]->op == SYMBOL) { // ID
-            Symbol* ptr = check_variable(ast->children[0]->str, ast->lineno);
+        case PROD_EXP_ID: {
+            Symbol* ptr = check_variable(ast->children[0]->val, ast->lineno);
             if (ptr) {
                 return ExprType(true, ptr->type);
             }
-        } else if (ast->children[0]->op == INT_CONST) { // INT
-            return ExprType(false, "int");
-        } else if (ast->children[0]->op == FLOAT_CONST) { // FLOAT
-            return ExprType(false, "float");
-        } else if (ast->children[0]->op == CHAR_CONST) { // CHAR
-            return ExprType(false, "char");
+            break;
         }
-    } else {
-        visitChildren(ast);
+        case PROD_EXP_INT:
+            return ExprType(false, primitive_type(TYPE_INT));
+        case PROD_EXP_FLOAT:
+            return ExprType(false, primitive_type(TYPE_FLOAT));
+        case PROD_EXP_CHAR:
+            return ExprType(false, primitive_type(TYPE_CHAR));
+        default:
+            visitChildren(ast);
     }
-    return ExprType(false, "");
+    return ExprType(false, nullptr);
+}
+
+// lowering takes the type of each expression from its node
+ExprType visitExp(AST* ast) {
+    ExprType type = checkExp(ast);
+    ast->type = type.type;
+    return type;
 }
 
 Symbol visitParamDec(AST* ast) {
-    std::string specifier = symbol_from_specifier(ast->children[0]);
-    Symbol symbol = visitVarDec(specifier, ast->children[1]);
-    symbol.type = specifier;
-    return symbol;
+    const Type* specifier = symbol_from_specifier(ast->children[0]);
+    return visitVarDec(specifier, ast->children[1]);
 }
 
 std::vector<Symbol> visitVarList(AST* ast) {
-    if (ast->num_children == 1) { // ParamDec
-        return { visitParamDec(ast->children[0]) };
-    } else { // ParamDec COMMA VarList
-        auto vec = visitVarList(ast->children[2]);
-        vec.push_back(visitParamDec(ast->children[0]));
-        return vec;
+    std::vector<Symbol> vec = { visitParamDec(ast->children[0]) };
+    if (ast->num_children == 3) { // ParamDec COMMA VarList
+        auto rest = visitVarList(ast->children[2]);
+        vec.insert(vec.end(), rest.begin(), rest.end());
     }
+    return vec;
 }
 
 Symbol visitFunDec(AST* ast) {
-    Symbol symbol(FUNCTION, ast->children[0]->str);
+    Symbol symbol(FUNCTION, ast->children[0]->val);
     if (ast->num_children == 4) {
         auto varList = visitVarList(ast->children[2]);
         for (auto& var : varList) {
@@ -391,7 +483,7 @@ Symbol visitFunDec(AST* ast) {
     return symbol;
 }
 
-std::vector<Symbol> visitExtDecList(std::string specifier, AST* ast) {
+std::vector<Symbol> visitExtDecList(const Type* specifier, AST* ast) {
     if (ast->num_children == 1) { // VarDec
         return { visitVarDec(specifier, ast->children[0]) };
     } else { // VarDec COMMA ExtDecList
@@ -402,20 +494,18 @@ std::vector<Symbol> visitExtDecList(std::string specifier, AST* ast) {
 }
 
 void visitExtDef(AST* ast) {
-    std::string specifier = symbol_from_specifier(ast->children[0]);
-    if (ast->num_children == 3 && ast->to_string() == "ExtDef_SpecifierExtDecListSEMI") {
+    const Type* specifier = symbol_from_specifier(ast->children[0]);
+    if (ast->prod == PROD_EXTDEF_VARS) {
         auto symbols = visitExtDecList(specifier, ast->children[1]);
         for (auto& symbol : symbols) {
             insert_symbol(symbol, ast->lineno);
         }
-    } else if (ast->num_children == 3 && ast->to_string() == "ExtDef_SpecifierFunDecCompSt") {
+    } else if (ast->prod == PROD_EXTDEF_FUNC) {
         symbol_push_stack();
         auto symbol = visitFunDec(ast->children[1]);
         symbol.type = specifier;
-        insert_symbol(symbol, ast->lineno);
-        std::string alt_name = symbol.to_string();
-        current_scope = alt_name;
-        symbol_table[0][alt_name] = symbol;
+        Symbol* function = insert_symbol(symbol, ast->lineno);
+        current_function = function ? function : &symbol;
         visitNode(ast->children[2]);
         symbol_pop_stack();
     } else {
@@ -433,10 +523,9 @@ void visitCompSt(AST* ast) {
 }
 
 void visitStmt(AST* ast) {
-    if (ast->num_children == 3 && ast->children[0]->op == RETURN_SIGN) { // RETURN Exp SEMI
-        Symbol current_fun = symbol_table[0][current_scope]; // Functions are always at global scope
+    if (ast->prod == PROD_STMT_RETURN) { // RETURN Exp SEMI
         ExprType rtype = visitExp(ast->children[1]);
-        if (ExprType(true, current_fun.type) != rtype) {
+        if (ExprType(true, current_function->type) != rtype) {
             semantic_error(8, ast->lineno, "function return type mismatch the declared type");
         }
     } else {
@@ -444,15 +533,40 @@ void visitStmt(AST* ast) {
     }
 }
 
-void initHandlers() {
-    Symbol symbol_int(VARIABLE, "int"), symbol_float(VARIABLE, "float"), symbol_char(VARIABLE, "char");
-    symbol_int.type = "int", symbol_float.type = "float", symbol_char.type = "char";
-    insert_symbol(symbol_int, -1);
-    insert_symbol(symbol_float, -1);
-    insert_symbol(symbol_char, -1);
-    
-    handler_map[EXTDEF] = visitExtDef;
-    handler_map[COMPST] = visitCompSt;
-    handler_map[STMT] = visitStmt;
-    handler_map[EXP] = visitExp;
+void visitNode(AST* ast) {
+    if (ast) {
+        switch (ast->op) {
+            case EXTDEF: visitExtDef(ast); break;
+            case COMPST: visitCompSt(ast); break;
+            case STMT: visitStmt(ast); break;
+            case EXP: visitExp(ast); break;
+            default: visitChildren(ast);
+        }
+    }
+}
+
+// drop every symbol and type once the program is lowered
+void semanticFree() {
+    type_pool.clear();
+    array_types.clear();
+    struct_equivalence.clear();
+    symbol_pool.clear();
+    local_symbols.clear();
+    std::vector<std::vector<SymbolBinding>>().swap(symbol_bindings);
+    symbol_undo.clear();
+    symbol_scopes.clear();
+    current_function = nullptr;
+    stack_depth = 0;
+}
+
+// read and write are predeclared as the IR provides them
+void semanticReset(FILE* out) {
+    semanticFree();
+    semantic_out = out;
+    semantic_errors = 0;
+    Symbol read(FUNCTION, ATOM_READ), write(FUNCTION, ATOM_WRITE);
+    read.type = write.type = primitive_type(TYPE_INT);
+    write.params.push_back(primitive_type(TYPE_INT));
+    insert_symbol(read, 0);
+    insert_symbol(write, 0);
 }
@@ -1,76 +1,86 @@
 #pragma once
 #include "ast.h"
-#include <unordered_map>
-#include <functional>
+#include <cstdio>
 #include <string>
 #include <vector>
 
 enum SymbolType { VARIABLE, STRUCTDEF, FUNCTION };
 
-int stack_depth = 0;
+thread_local int stack_depth = 0;
+
+struct Symbol;
+
+enum TypeKind { PRIMITIVE_TYPE, ARRAY_TYPE, STRUCT_TYPE };
+
+// types are hash-consed: every distinct type is one node, so identical
+// types are the same pointer
+struct Type {
+    TypeKind kind;
+    int id;
+    int primitive; // TYPE_INT, TYPE_FLOAT or TYPE_CHAR
+    const Type* element = nullptr;
+    int length = 0;
+    Symbol* structdef = nullptr;
+    
+    std::string to_string() const;
+};
+
+const Type* primitive_type(int primitive);
+
+const Type* array_type(const Type* element, int length);
+
+bool type_equivalent(const Type* a, const Type* b);
 
 struct Symbol {
     SymbolType symbol_type;
-    std::string type;
+    const Type* type = nullptr;
     std::string name;
+    int atom;
     
-    std::vector<std::string> params;
+    std::vector<const Type*> params;
     std::vector<Symbol> members;
     
     Symbol() = default;
     
-    Symbol(SymbolType symbol_type, std::string name) : symbol_type(symbol_type), name(name) {}
+    Symbol(SymbolType symbol_type, int atom) : symbol_type(symbol_type), name(atomName(atom)), atom(atom) {}
     
     std::string to_string() {
-        std::string str = type + " " + name;
+        std::string str = (type ? type->to_string() : "?") + " " + name;
         if (symbol_type == FUNCTION) {
             str += "(";
-            for (const std::string& param : params) {
-                str += param + ",";
+            for (const Type* param : params) {
+                str += param->to_string() + ",";
             }
             str.pop_back();
             str += ")";
         }
         return str;
     };
-    
-    bool structual_equivalent(const Symbol& other);
 };
 
-Symbol* check_symbol(const std::string& name, int depth = stack_depth);
+Symbol* check_symbol(int atom);
 
 struct ExprType {
     bool l_value;
-    std::string type;
+    const Type* type;
     bool valid;
     
-    ExprType(bool l_value, std::string type) : l_value(l_value), type(type), valid(type != "") {};
+    ExprType(bool l_value, const Type* type) : l_value(l_value), type(type), valid(type != nullptr) {};
     
     bool isInt() const {
-        return type == "int";
+        return type == primitive_type(TYPE_INT);
     }
     
     bool isIntOrFloat() const {
-        return type == "int" || type == "float";
+        return type == primitive_type(TYPE_INT) || type == primitive_type(TYPE_FLOAT);
     }
     
     bool isChar() const {
-        return type == "char";
+        return type == primitive_type(TYPE_CHAR);
     }
     
     bool operator==(const ExprType& other) const {
-        if (!valid || !other.valid) {
-            return true;
-        } else if (type == other.type) {
-            return true;
-        } else {
-            Symbol* this_symbol = check_symbol(type);
-            Symbol* other_symbol = check_symbol(other.type);
-            if (this_symbol && this_symbol->symbol_type == STRUCTDEF && other_symbol && other_symbol->symbol_type == STRUCTDEF) {
-                return this_symbol->structual_equivalent(*other_symbol);
-            }
-        }
-        return false;
+        return !valid || !other.valid || type_equivalent(type, other.type);
     }
     
     bool operator!=(const ExprType& other) const {
@@ -79,7 +89,7 @@ struct ExprType {
     
     std::string to_string() const {
         if (valid) {
-            return type + "(" + (l_value ? "L" : "R") + ")";
+            return type->to_string() + "(" + (l_value ? "L" : "R") + ")";
         } else {
             return "invalid";
         }
@@ -88,4 +98,6 @@ struct ExprType {
 
 void visitNode(AST*);
 
-void initHandlers();
+void semanticReset(FILE* out);
+
+void semanticFree();
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+// libsplc: compile SPL source held in memory; safe to call from several
+// threads at once, each call owns its scanner, parser and IR state
+
+struct SplcOptions {
+    const char* profile_generate = nullptr; // run the program and write its profile instead of IR
+
+    const char* profile_use = nullptr;
+
+    const char* include_cache = nullptr; // directory keeping scanned headers across runs
+
+    bool mem_report = false; // fill SplcResult::report with the memory in use after each phase
+
+    bool bulk_memory = false; // emit FILL/COPY for array fill and copy loops, which the course simulator cannot run
+
+    bool vectorize = false; // emit VLOAD/VSTORE/VADD/... for array loops, which the course simulator cannot run
+
+    FILE* stream = nullptr; // write the IR here one function at a time, while the rest is still parsed
+};
+
+struct SplcResult {
+    int status = 0; // 0 on success, 1 on lexical/syntax/semantic errors, -1 if a file could not be read or written
+
+    std::string output; // the IR unless streamed, or the error messages
+
+    std::string report; // see SplcOptions::mem_report
+};
+
+SplcResult splcCompile(const char* src, size_t len, const SplcOptions& options = SplcOptions());
+
+// compile a file mapped into memory, without copying it into the scanner
+SplcResult splcCompileFile(const char* path, const SplcOptions& options = SplcOptions());
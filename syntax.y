@@ -1,16 +1,72 @@
+%code requires {
+    #include <cstdio>
+    #include <string>
+    #include <unordered_set>
+    #include <vector>
+    #include "include_cache.hpp"
+    #ifndef YY_TYPEDEF_YY_SCANNER_T
+    #define YY_TYPEDEF_YY_SCANNER_T
+    typedef void* yyscan_t;
+    #endif
+
+    struct SplSource {
+        char* base;
+        size_t size;
+    };
+
+    // a header being replayed, and the line to resume at once it is done
+    struct SplReplay {
+        const SplHeader* header;
+        size_t next;
+        int lineno;
+    };
+
+    // per-compilation state shared by the scanner and the parser
+    struct SplState {
+        int errorstatus = 0;
+        int errlineno = 0;
+        std::unordered_set<std::string> included; // canonical paths, each included at most once
+        std::vector<SplReplay> replay;
+        std::vector<const SplHeader*> uncached; // headers with lexical errors, owned here
+        SplHeader* recording = nullptr; // set while scanning a header into the cache
+        const char* include_cache = nullptr; // directory persisting scanned headers
+        std::vector<SplSource> sources; // mapped files, tokens point into them
+        struct AbstractSyntaxTree* root = nullptr;
+        FILE* out = stdout; // IR and error messages
+        struct IRStream* stream = nullptr; // set while compiling function by function
+    };
+}
+
 %{
+    #include <malloc.h>
+    #include <sys/resource.h>
     #include "lex.yy.c"
     #include "ast.h"
-    //#include "semantic.cpp"
+    #include "semantic.cpp"
     #include "ir_codegen.hpp"
     #include "ir_optimizer.hpp"
     #include "ir_inliner.hpp"
-    int errorstatus = 0;
-    int errlineno = 0;
-    void yyerror(const char*);
-    AST* root = NULL;
+    #include "ir_interp.hpp"
+    #include "ir_profile.hpp"
+    #include "ir_layout.hpp"
+    #include "ir_tailcall.hpp"
+    #include "ir_ipcp.hpp"
+    #include "ir_purity.hpp"
+    #include "ir_sra.hpp"
+    #include "ir_memory.hpp"
+    #include "ir_vectorize.hpp"
+    #include "ir_idiom.hpp"
+    #include "ir_stream.hpp"
+    #include "splc.h"
+    void yyerror(YYLTYPE* loc, yyscan_t scanner, SplState* state, const char* msg);
+    void streamExtDef(SplState* state, AST* extdef, bool rewind);
 %}
 
+%define api.pure full
+%locations
+%lex-param {yyscan_t scanner}
+%parse-param {yyscan_t scanner} {SplState* state}
+
 %union {
     struct AbstractSyntaxTree *val;
     int type;
@@ -47,38 +103,46 @@
 %%
 
 TopLevel
-    : Program { root = $1; }
+    : Program { state->root = $1; }
     ;
 Program
-    : ExtDefList { $$ = makeAST(PROGRAM, @$.first_line); insertChild($$, $1); }
+    : ExtDefList { $$ = makeAST(PROGRAM, @$.first_line, PROD_PROGRAM); insertChild($$, $1); }
     ;
 ExtDefList
-    : ExtDef ExtDefList { $$ = makeAST(EXTDEFLIST, @$.first_line); insertChild($$, $1); insertChild($$, $2); }
+    : ExtDefList ExtDef {
+        if (state->stream) {
+            // only a lookahead token can own a node the definition does not
+            streamExtDef(state, $2, yychar == YYEMPTY);
+            $$ = NULL;
+        } else {
+            $$ = insertChild($1 ? $1 : makeAST(EXTDEFLIST, @2.first_line, PROD_EXTDEFLIST), $2);
+        }
+    }
     | %empty { $$ = NULL; }
     ;
 ExtDef
     : Specifier ExtDecList SEMI {
-        $$ = makeAST(EXTDEF, @$.first_line);
+        $$ = makeAST(EXTDEF, @$.first_line, PROD_EXTDEF_VARS);
         insertChild($$, $1);
         insertChild($$, $2);
         insertChild($$, makeSign(SEMI_SIGN));
     }
     | Specifier SEMI {
-        $$ = makeAST(EXTDEF, @$.first_line);
+        $$ = makeAST(EXTDEF, @$.first_line, PROD_EXTDEF_TYPE);
         insertChild($$, $1);
         insertChild($$, makeSign(SEMI_SIGN));
     }
     | Specifier FunDec CompSt {
-        $$ = makeAST(EXTDEF, @$.first_line);
+        $$ = makeAST(EXTDEF, @$.first_line, PROD_EXTDEF_FUNC);
         insertChild($$, $1);
         insertChild($$, $2);
         insertChild($$, $3);
     }
     ;
 ExtDecList
-    : VarDec { $$ = makeAST(EXTDECLIST, @$.first_line); insertChild($$, $1); }
+    : VarDec { $$ = makeAST(EXTDECLIST, @$.first_line, PROD_EXTDECLIST_ONE); insertChild($$, $1); }
     | VarDec COMMA ExtDecList {
-        $$ = makeAST(EXTDECLIST, @$.first_line);
+        $$ = makeAST(EXTDECLIST, @$.first_line, PROD_EXTDECLIST_MORE);
         insertChild($$, $1);
         insertChild($$, makeSign(COMMA_SIGN));
         insertChild($$, $3);
@@ -86,12 +150,12 @@ ExtDecList
     ;
 
 Specifier
-    : TYPE { $$ = makeAST(SPECIFIER, @$.first_line); $$->val = $1; }
-    | StructSpecifier { $$ = makeAST(SPECIFIER, @$.first_line); insertChild($$, $1); }
+    : TYPE { $$ = makeAST(SPECIFIER, @$.first_line, PROD_SPECIFIER_TYPE); $$->val = $1; }
+    | StructSpecifier { $$ = makeAST(SPECIFIER, @$.first_line, PROD_SPECIFIER_STRUCT); insertChild($$, $1); }
     ;
 StructSpecifier
     : STRUCT ID LC DefList RC {
-        $$ = makeAST(STRUCTSPECIFIER, @$.first_line);
+        $$ = makeAST(STRUCTSPECIFIER, @$.first_line, PROD_STRUCT_DEF);
         insertChild($$, makeSign(STRUCT_SIGN));
         insertChild($$, $2);
         insertChild($$, makeSign(LC_SIGN));
@@ -99,16 +163,16 @@ StructSpecifier
         insertChild($$, makeSign(RC_SIGN));
     }
     | STRUCT ID {
-        $$ = makeAST(STRUCTSPECIFIER, @$.first_line);
+        $$ = makeAST(STRUCTSPECIFIER, @$.first_line, PROD_STRUCT_USE);
         insertChild($$, makeSign(STRUCT_SIGN));
         insertChild($$, $2);
     }
     ;
 
 VarDec
-    : ID { $$ = makeAST(VARDEC, @$.first_line); insertChild($$, $1); }
+    : ID { $$ = makeAST(VARDEC, @$.first_line, PROD_VARDEC_ID); insertChild($$, $1); }
     | VarDec LB INT RB {
-        $$ = makeAST(VARDEC, @$.first_line);
+        $$ = makeAST(VARDEC, @$.first_line, PROD_VARDEC_ARRAY);
         insertChild($$, $1);
         insertChild($$, makeSign(LB_SIGN));
         insertChild($$, $3);
@@ -116,14 +180,14 @@ VarDec
     }
 FunDec
     : ID LP VarList RP {
-        $$ = makeAST(FUNDEC, @$.first_line);
+        $$ = makeAST(FUNDEC, @$.first_line, PROD_FUNDEC_PARAMS);
         insertChild($$, $1);
         insertChild($$, makeSign(LP_SIGN));
         insertChild($$, $3);
         insertChild($$, makeSign(RP_SIGN));
     }
     | ID LP RP { 
-        $$ = makeAST(FUNDEC, @$.first_line);
+        $$ = makeAST(FUNDEC, @$.first_line, PROD_FUNDEC_EMPTY);
         insertChild($$, $1);
         insertChild($$, makeSign(LP_SIGN));
         insertChild($$, makeSign(RP_SIGN));
@@ -131,16 +195,16 @@ FunDec
     ;
 VarList
     : ParamDec COMMA VarList {
-        $$ = makeAST(VARLIST, @$.first_line);
+        $$ = makeAST(VARLIST, @$.first_line, PROD_VARLIST_MORE);
         insertChild($$, $1);
         insertChild($$, makeSign(COMMA_SIGN));
         insertChild($$, $3);
     }
-    | ParamDec { $$ = makeAST(VARLIST, @$.first_line); insertChild($$, $1); }
+    | ParamDec { $$ = makeAST(VARLIST, @$.first_line, PROD_VARLIST_ONE); insertChild($$, $1); }
     ;
 ParamDec
     : Specifier VarDec {
-        $$ = makeAST(PARAMDEC, @$.first_line);
+        $$ = makeAST(PARAMDEC, @$.first_line, PROD_PARAMDEC);
         insertChild($$, $1);
         insertChild($$, $2);
     }
@@ -148,7 +212,7 @@ ParamDec
 
 CompSt
     : LC DefList StmtList RC {
-        $$ = makeAST(COMPST, @$.first_line);
+        $$ = makeAST(COMPST, @$.first_line, PROD_COMPST);
         insertChild($$, makeSign(LC_SIGN));
         insertChild($$, $2);
         insertChild($$, $3);
@@ -156,30 +220,30 @@ CompSt
     }
     ;
 StmtList
-    : Stmt StmtList { $$ = makeAST(STMTLIST, @$.first_line); insertChild($$, $1); insertChild($$, $2); }
+    : StmtList Stmt { $$ = insertChild($1 ? $1 : makeAST(STMTLIST, @2.first_line, PROD_STMTLIST), $2); }
     | %empty { $$ = NULL; }
     ;
 Stmt
-    : Exp SEMI { $$ = makeAST(STMT, @$.first_line); insertChild($$, $1); insertChild($$, makeSign(SEMI_SIGN)); }
-    | CompSt { $$ = makeAST(STMT, @$.first_line); insertChild($$, $1); }
+    : Exp SEMI { $$ = makeAST(STMT, @$.first_line, PROD_STMT_EXP); insertChild($$, $1); insertChild($$, makeSign(SEMI_SIGN)); }
+    | CompSt { $$ = makeAST(STMT, @$.first_line, PROD_STMT_COMPST); insertChild($$, $1); }
     | CONTINUE SEMI {
-        $$ = makeAST(STMT, @$.first_line);
+        $$ = makeAST(STMT, @$.first_line, PROD_STMT_CONTINUE);
         insertChild($$, makeSign(CONTINUE_SIGN));
         insertChild($$, makeSign(SEMI_SIGN));
     }
     | BREAK SEMI {
-        $$ = makeAST(STMT, @$.first_line);
+        $$ = makeAST(STMT, @$.first_line, PROD_STMT_BREAK);
         insertChild($$, makeSign(BREAK_SIGN));
         insertChild($$, makeSign(SEMI_SIGN));
     }
     | RETURN Exp SEMI {
-        $$ = makeAST(STMT, @$.first_line);
+        $$ = makeAST(STMT, @$.first_line, PROD_STMT_RETURN);
         insertChild($$, makeSign(RETURN_SIGN));
         insertChild($$, $2);
         insertChild($$, makeSign(SEMI_SIGN));
     }
     | IF LP Exp RP Stmt %prec THEN {
-        $$ = makeAST(STMT, @$.first_line);
+        $$ = makeAST(STMT, @$.first_line, PROD_STMT_IF);
         insertChild($$, makeSign(IF_SIGN));
         insertChild($$, makeSign(LP_SIGN));
         insertChild($$, $3);
@@ -187,7 +251,7 @@ Stmt
         insertChild($$, $5);
     }
     | IF LP Exp RP Stmt ELSE Stmt {
-        $$ = makeAST(STMT, @$.first_line);
+        $$ = makeAST(STMT, @$.first_line, PROD_STMT_IFELSE);
         insertChild($$, makeSign(IF_SIGN));
         insertChild($$, makeSign(LP_SIGN));
         insertChild($$, $3);
@@ -197,7 +261,7 @@ Stmt
         insertChild($$, $7);
     }
     | DO Stmt WHILE LP Exp RP SEMI {
-        $$ = makeAST(STMT, @$.first_line);
+        $$ = makeAST(STMT, @$.first_line, PROD_STMT_DO);
         insertChild($$, makeSign(DO_SIGN));
         insertChild($$, $2);
         insertChild($$, makeSign(WHILE_SIGN));
@@ -207,7 +271,7 @@ Stmt
         insertChild($$, makeSign(SEMI_SIGN));
     }
     | WHILE LP Exp RP Stmt {
-        $$ = makeAST(STMT, @$.first_line);
+        $$ = makeAST(STMT, @$.first_line, PROD_STMT_WHILE);
         insertChild($$, makeSign(WHILE_SIGN));
         insertChild($$, makeSign(LP_SIGN));
         insertChild($$, $3);
@@ -215,7 +279,7 @@ Stmt
         insertChild($$, $5);
     }
     | FOR LP OptionalExp SEMI OptionalExp SEMI OptionalExp RP Stmt {
-        $$ = makeAST(STMT, @$.first_line);
+        $$ = makeAST(STMT, @$.first_line, PROD_STMT_FOR);
         insertChild($$, makeSign(FOR_SIGN));
         insertChild($$, makeSign(LP_SIGN));
         insertChild($$, $3);
@@ -229,30 +293,30 @@ Stmt
     ;
 
 DefList
-    : Def DefList { $$ = makeAST(DEFLIST, @$.first_line); insertChild($$, $1); insertChild($$, $2); }
+    : DefList Def { $$ = insertChild($1 ? $1 : makeAST(DEFLIST, @2.first_line, PROD_DEFLIST), $2); }
     | %empty { $$ = NULL; }
     ;
 Def
     : Specifier DecList SEMI {
-        $$ = makeAST(DEF, @$.first_line);
+        $$ = makeAST(DEF, @$.first_line, PROD_DEF);
         insertChild($$, $1);
         insertChild($$, $2);
         insertChild($$, makeSign(SEMI_SIGN));
     }
     ;
 DecList
-    : Dec { $$ = makeAST(DECLIST, @$.first_line); insertChild($$, $1); }
+    : Dec { $$ = makeAST(DECLIST, @$.first_line, PROD_DECLIST_ONE); insertChild($$, $1); }
     | Dec COMMA DecList {
-        $$ = makeAST(DECLIST, @$.first_line);
+        $$ = makeAST(DECLIST, @$.first_line, PROD_DECLIST_MORE);
         insertChild($$, $1);
         insertChild($$, makeSign(COMMA_SIGN));
         insertChild($$, $3);
     }
     ;
 Dec
-    : VarDec { $$ = makeAST(DEC, @$.first_line); insertChild($$, $1); }
+    : VarDec { $$ = makeAST(DEC, @$.first_line, PROD_DEC); insertChild($$, $1); }
     | VarDec ASSIGN Exp {
-        $$ = makeAST(DEC, @$.first_line);
+        $$ = makeAST(DEC, @$.first_line, PROD_DEC_INIT);
         insertChild($$, $1);
         insertChild($$, makeSign(ASSIGN_OP));
         insertChild($$, $3);
@@ -265,191 +329,327 @@ OptionalExp
     ;
 Exp
     : Exp ASSIGN Exp {
-        $$ = makeAST(EXP, @$.first_line);
+        $$ = makeAST(EXP, @$.first_line, PROD_EXP_ASSIGN);
         insertChild($$, $1);
         insertChild($$, makeSign(ASSIGN_OP));
         insertChild($$, $3);
     }
     | Exp AND Exp {
-        $$ = makeAST(EXP, @$.first_line);
+        $$ = makeAST(EXP, @$.first_line, PROD_EXP_AND);
         insertChild($$, $1);
         insertChild($$, makeSign(AND_OP));
         insertChild($$, $3);
     }
     | Exp OR Exp {
-        $$ = makeAST(EXP, @$.first_line);
+        $$ = makeAST(EXP, @$.first_line, PROD_EXP_OR);
         insertChild($$, $1);
         insertChild($$, makeSign(OR_OP));
         insertChild($$, $3);
     }
     | Exp LT Exp {
-        $$ = makeAST(EXP, @$.first_line);
+        $$ = makeAST(EXP, @$.first_line, PROD_EXP_LT);
         insertChild($$, $1);
         insertChild($$, makeSign(LT_OP));
         insertChild($$, $3);
     }
     | Exp LE Exp {
-        $$ = makeAST(EXP, @$.first_line);
+        $$ = makeAST(EXP, @$.first_line, PROD_EXP_LE);
         insertChild($$, $1);
         insertChild($$, makeSign(LE_OP));
         insertChild($$, $3);
     }
     | Exp GT Exp {
-        $$ = makeAST(EXP, @$.first_line);
+        $$ = makeAST(EXP, @$.first_line, PROD_EXP_GT);
         insertChild($$, $1);
         insertChild($$, makeSign(GT_OP));
         insertChild($$, $3);
     }
     | Exp GE Exp {
-        $$ = makeAST(EXP, @$.first_line);
+        $$ = makeAST(EXP, @$.first_line, PROD_EXP_GE);
         insertChild($$, $1);
         insertChild($$, makeSign(GE_OP));
         insertChild($$, $3);
     }
     | Exp NE Exp {
-        $$ = makeAST(EXP, @$.first_line);
+        $$ = makeAST(EXP, @$.first_line, PROD_EXP_NE);
         insertChild($$, $1);
         insertChild($$, makeSign(NE_OP));
         insertChild($$, $3);
     }
     | Exp EQ Exp {
-        $$ = makeAST(EXP, @$.first_line);
+        $$ = makeAST(EXP, @$.first_line, PROD_EXP_EQ);
         insertChild($$, $1);
         insertChild($$, makeSign(EQ_OP));
         insertChild($$, $3);
     }
     | Exp PLUS Exp {
-        $$ = makeAST(EXP, @$.first_line);
+        $$ = makeAST(EXP, @$.first_line, PROD_EXP_PLUS);
         insertChild($$, $1);
         insertChild($$, makeSign(PLUS_OP));
         insertChild($$, $3);
     }
     | Exp MINUS Exp {
-        $$ = makeAST(EXP, @$.first_line);
+        $$ = makeAST(EXP, @$.first_line, PROD_EXP_MINUS);
         insertChild($$, $1);
         insertChild($$, makeSign(MINUS_OP));
         insertChild($$, $3);
     }
     | Exp MUL Exp {
-        $$ = makeAST(EXP, @$.first_line);
+        $$ = makeAST(EXP, @$.first_line, PROD_EXP_MUL);
         insertChild($$, $1);
         insertChild($$, makeSign(MUL_OP));
         insertChild($$, $3);
     }
     | Exp DIV Exp {
-        $$ = makeAST(EXP, @$.first_line);
+        $$ = makeAST(EXP, @$.first_line, PROD_EXP_DIV);
         insertChild($$, $1);
         insertChild($$, makeSign(DIV_OP));
         insertChild($$, $3);
     }
     | LP Exp RP {
-        $$ = makeAST(EXP, @$.first_line);
+        $$ = makeAST(EXP, @$.first_line, PROD_EXP_PAREN);
         insertChild($$, makeSign(LP_SIGN));
         insertChild($$, $2);
         insertChild($$, makeSign(RP_SIGN));
     }
     | MINUS Exp %prec UMINUS {
-        $$ = makeAST(EXP, @$.first_line);
+        $$ = makeAST(EXP, @$.first_line, PROD_EXP_NEG);
         insertChild($$, makeSign(MINUS_OP));
         insertChild($$, $2);
     }
     | NOT Exp {
-        $$ = makeAST(EXP, @$.first_line);
+        $$ = makeAST(EXP, @$.first_line, PROD_EXP_NOT);
         insertChild($$, makeSign(NOT_OP));
         insertChild($$, $2);
     }
     | ID LP Args RP {
-        $$ = makeAST(EXP, @$.first_line);
+        $$ = makeAST(EXP, @$.first_line, PROD_EXP_CALL);
         insertChild($$, $1);
         insertChild($$, makeSign(LP_SIGN));
         insertChild($$, $3);
         insertChild($$, makeSign(RP_SIGN));
     }
     | ID LP RP {
-        $$ = makeAST(EXP, @$.first_line);
+        $$ = makeAST(EXP, @$.first_line, PROD_EXP_CALL_EMPTY);
         insertChild($$, $1);
         insertChild($$, makeSign(LP_SIGN));
         insertChild($$, makeSign(RP_SIGN));
     }
     | Exp LB Exp RB {
-        $$ = makeAST(EXP, @$.first_line);
+        $$ = makeAST(EXP, @$.first_line, PROD_EXP_INDEX);
         insertChild($$, $1);
         insertChild($$, makeSign(LB_SIGN));
         insertChild($$, $3);
         insertChild($$, makeSign(RB_SIGN));
     }
     | Exp DOT ID { 
-        $$ = makeAST(EXP, @$.first_line);
+        $$ = makeAST(EXP, @$.first_line, PROD_EXP_MEMBER);
         insertChild($$, $1);
         insertChild($$, makeSign(DOT_SIGN));
         insertChild($$, $3);
     }
-    | ID { $$ = makeAST(EXP, @$.first_line); insertChild($$, $1); }
-    | INT { $$ = makeAST(EXP, @$.first_line); insertChild($$, $1); }
-    | FLOAT { $$ = makeAST(EXP, @$.first_line); insertChild($$, $1); }
-    | CHAR { $$ = makeAST(EXP, @$.first_line); insertChild($$, $1); }
+    | ID { $$ = makeAST(EXP, @$.first_line, PROD_EXP_ID); insertChild($$, $1); }
+    | INT { $$ = makeAST(EXP, @$.first_line, PROD_EXP_INT); insertChild($$, $1); }
+    | FLOAT { $$ = makeAST(EXP, @$.first_line, PROD_EXP_FLOAT); insertChild($$, $1); }
+    | CHAR { $$ = makeAST(EXP, @$.first_line, PROD_EXP_CHAR); insertChild($$, $1); }
     ;
 Args
-    : Exp COMMA Args {
-        $$ = makeAST(ARGS, @$.first_line);
-        insertChild($$, $1);
-        insertChild($$, makeSign(COMMA_SIGN));
-        insertChild($$, $3);
-    }
-    | Exp { 
-        $$ = makeAST(ARGS, @$.first_line);
-        insertChild($$, $1);
-    }
+    : Args COMMA Exp { $$ = insertChild($1, $3); }
+    | Exp { $$ = makeAST(ARGS, @$.first_line, PROD_ARGS); insertChild($$, $1); }
     ;
 
 %%
 
-void yyerror(const char* msg) {
-    if (errlineno && yylineno > errlineno) {
-        printf("Error type B at Line %d: syntax error\n", errlineno);
-        errlineno = yylineno;
+void yyerror(YYLTYPE* loc, yyscan_t scanner, SplState* state, const char* msg) {
+    int lineno = yyget_lineno(scanner);
+    if (state->errlineno && lineno > state->errlineno) {
+        fprintf(state->out, "Error type B at Line %d: syntax error\n", state->errlineno);
+        state->errlineno = lineno;
     }
     if (msg && strcmp(msg, "syntax error")) {
-        printf("Error type B at Line %d: %s\n", yylineno, msg);
-        errlineno = 0;
+        fprintf(state->out, "Error type B at Line %d: %s\n", lineno, msg);
+        state->errlineno = 0;
     } else {
-        errlineno = yylineno;
+        state->errlineno = lineno;
     }
-    errorstatus = 1;
+    state->errorstatus = 1;
+}
+
+// heap in use after a phase and the peak RSS so far; both are process-wide,
+// so with several compilations running they cover all of them
+void memPhase(SplcResult& result, const SplcOptions& options, const char* phase) {
+    if (!options.mem_report) {
+        return;
+    }
+    struct mallinfo2 info = mallinfo2();
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    char line[128];
+    snprintf(line, sizeof(line), "%-10s %10zu KB in use %10ld KB peak RSS\n", phase, (info.uordblks + info.hblkhd) >> 10, usage.ru_maxrss);
+    result.report += line;
 }
 
-int main(int argc, char** argv) {
-    if(argc != 2) {
-        fprintf(stderr, "Usage: %s <file_path>\n", argv[0]);
-        exit(-1);
+// streamed compilation: check and lower a definition as soon as it is
+// reduced, queue its IR for the optimizer thread and reuse its nodes
+void streamExtDef(SplState* state, AST* extdef, bool rewind) {
+    if (!state->errorstatus) {
+        visitNode(extdef);
     }
-    else if(!(yyin = fopen(argv[1], "r"))) {
-        perror(argv[1]);
-        exit(-1);
+    if (!state->errorstatus && !semantic_errors) {
+        Code* code = translateCode(extdef);
+        if (code) {
+            irStreamPush(state->stream, code);
+        }
     }
-    yyparse();
-    if (errorstatus) {
-        yylineno++;
-        yyerror(NULL);
+    if (rewind) {
+        rewindAST();
     }
-    if (!errorstatus && root) {
+}
+
+// IR state lives in thread_local globals, reset here so every call starts
+// fresh; the scanner is destroyed and the sources unmapped only at the end
+// because identifiers and literals in the AST are views into their buffers
+SplcResult compileScanner(yyscan_t scanner, SplState& state, char*& buffer, size_t& size, const SplcOptions& options) {
+    SplcResult result;
+    freeAST();
+    resetAtoms();
+    irResetCodegen();
+    profile_loaded = false;
+    profile_max_call = 0;
+
+    if (options.stream && !options.profile_generate && !options.profile_use) {
+        semanticReset(state.out);
+        state.stream = irStreamStart(options.stream, options.bulk_memory, options.vectorize);
+    }
+    yyset_lineno(1, scanner);
+    yyparse(scanner, &state);
+    if (state.errorstatus) {
+        yyset_lineno(yyget_lineno(scanner) + 1, scanner);
+        yyerror(NULL, scanner, &state, NULL);
+    }
+    result.status = state.errorstatus;
+    memPhase(result, options, "parse");
+    if (state.stream) {
+        irStreamFinish(state.stream);
+        state.stream = nullptr;
+        if (semantic_errors) {
+            result.status = 1;
+        }
+        memPhase(result, options, "optimize");
+        freeAST();
+        semanticFree();
+        state.root = nullptr;
+        irResetCodegen();
+        memPhase(result, options, "free IR");
+    } else if (!state.errorstatus && state.root) {
         //printAST(root, 0);
-        //char* output_path = (char*) calloc(strlen(argv[1]) + 4, sizeof(char));
-        //strcpy(output_path, argv[1]);
-        //char* ext_ptr = strrchr(output_path, '.');
-        //*ext_ptr = '\0';
-        //strcat(output_path, ".out");
-        //if (!freopen(output_path, "w", stdout)) {
-        //    perror(output_path);
-        //    exit(-1);
-        //}
-        //initHandlers();
-        //visitNode(root);
-        Code* head = translateCode(root);
-        irOptimize(head);
-        irInline(head);
-        irOptimize(head);
-        irPrint(head);
-    }
-    return 0;
+        // one walk over the definitions: each is checked and, while the
+        // program is still free of semantic errors, lowered right after
+        semanticReset(state.out);
+        Code *head = nullptr, *tail = nullptr;
+        AST* list = state.root->num_children ? state.root->children[0] : nullptr;
+        for (int i = 0; list && i < list->num_children; i++) {
+            visitNode(list->children[i]);
+            if (!semantic_errors) {
+                appendCode(head, tail, translateCode(list->children[i]));
+            }
+        }
+        memPhase(result, options, "lower");
+        freeAST();
+        semanticFree();
+        state.root = nullptr;
+        memPhase(result, options, "free AST");
+        if (options.profile_generate || options.profile_use) {
+            irFixPrev(head);
+            irProfileLabelBlocks(head);
+        }
+        if (semantic_errors) {
+            result.status = 1;
+        } else if (options.profile_generate) {
+            if (!irInterpret(head)) {
+                fprintf(state.out, "%s: the profiling run trapped: calls nested too deep, out of memory or division by zero\n", options.profile_generate);
+                result.status = -1;
+            } else if (!irProfileWrite(head, options.profile_generate)) {
+                fprintf(state.out, "%s: %s\n", options.profile_generate, strerror(errno));
+                result.status = -1;
+            }
+        } else if (options.profile_use && !irProfileRead(head, options.profile_use)) {
+            fprintf(state.out, "%s: %s\n", options.profile_use, strerror(errno));
+            result.status = -1;
+        } else {
+            irOptimize(head);
+            irScalarReplaceOpt(head);
+            irTailCallOpt(head);
+            head = irInterproceduralConstantOpt(head);
+            irOptimize(head);
+            irPureCallOpt(head);
+            irOptimize(head);
+            head = irInline(head);
+            irOptimize(head);
+            irScalarReplaceOpt(head);
+            irMemoryOpt(head);
+            irOptimize(head);
+            irBlockLayout(head);
+            irOptimize(head);
+            if (options.bulk_memory) {
+                irIdiomOpt(head);
+            }
+            if (options.vectorize) {
+                irVectorizeOpt(head);
+            }
+            if (options.bulk_memory || options.vectorize) {
+                irOptimize(head);
+            }
+            memPhase(result, options, "optimize");
+            irPrint(head, state.out);
+        }
+        irFreeCode(head);
+        irResetCodegen();
+        memPhase(result, options, "free IR");
+    }
+    yylex_destroy(scanner);
+    for (const SplSource& source : state.sources) {
+        munmap(source.base, source.size + 2);
+    }
+    for (const SplHeader* header : state.uncached) {
+        delete header;
+    }
+    fclose(state.out);
+    result.output.assign(buffer, size);
+    free(buffer);
+    return result;
+}
+
+SplcResult splcCompile(const char* src, size_t len, const SplcOptions& options) {
+    char* buffer = NULL;
+    size_t size = 0;
+    SplState state;
+    state.out = open_memstream(&buffer, &size);
+    state.include_cache = options.include_cache;
+    yyscan_t scanner;
+    yylex_init_extra(&state, &scanner);
+    yy_scan_bytes(src, len, scanner);
+    return compileScanner(scanner, state, buffer, size, options);
+}
+
+SplcResult splcCompileFile(const char* path, const SplcOptions& options) {
+    size_t len;
+    char* source = mapSource(path, &len);
+    if (!source) {
+        return { -1, std::string(path) + ": " + strerror(errno) + "\n" };
+    }
+    char* buffer = NULL;
+    size_t size = 0;
+    SplState state;
+    state.out = open_memstream(&buffer, &size);
+    state.include_cache = options.include_cache;
+    state.sources.push_back({ source, len });
+    std::string canonical;
+    if (includeCanonicalPath(path, canonical)) {
+        state.included.insert(canonical);
+    }
+    yyscan_t scanner;
+    yylex_init_extra(&state, &scanner);
+    yy_scan_buffer(source, len + 2, scanner);
+    return compileScanner(scanner, state, buffer, size, options);
 }
@@ -0,0 +1,4 @@
+int limit()
+{
+    return 3 @ 1;
+}
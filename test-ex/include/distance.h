@@ -0,0 +1,6 @@
+#include "include/square.h"
+
+int distance(int x, int y)
+{
+    return square(x) + square(y);
+}
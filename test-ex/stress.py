@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+# stress test: compiles machine-generated programs of doubling size under a
+# small stack limit and checks that compile time grows linearly
+#
+#   python3 test-ex/stress.py bin/splc [max_statements]
+
+import os
+import resource
+import subprocess
+import sys
+import tempfile
+import time
+
+STACK_LIMIT = 1 << 20  # bytes; deep recursion over a list would overflow it
+
+MAX_GROWTH = 3.0  # time ratio allowed per doubling, 2 is linear
+
+
+def one_function(n):
+    lines = ["int main() {", "  int a = read(), b = read(), c = 0;"]
+    body = ["  c = a * 3 + b;", "  if (c > a) b = b + 1;", "  a = b - c;", "  write(a);"]
+    lines += [body[i % len(body)] for i in range(n)]
+    lines += ["  return 0;", "}"]
+    return "\n".join(lines) + "\n"
+
+
+def many_functions(n):
+    lines = []
+    for i in range(n // 4):
+        lines += [
+            "int f%d(int a, int b) {" % i,
+            "  int c = a * b + %d;" % i,
+            "  if (c > 10) { c = c - a; } else { c = c + b; }",
+            "  while (c > 100) { c = c / 2; }",
+            "  return c;",
+            "}",
+        ]
+    lines += ["int main() {", "  write(f0(read(), 3));", "  return 0;", "}"]
+    return "\n".join(lines) + "\n"
+
+
+def limit_stack():
+    resource.setrlimit(resource.RLIMIT_STACK, (STACK_LIMIT, STACK_LIMIT))
+
+
+def compile_time(splc, source):
+    with tempfile.NamedTemporaryFile("w", suffix=".spl", delete=False) as file:
+        file.write(source)
+    try:
+        start = time.time()
+        result = subprocess.run([splc, file.name], stdout=subprocess.PIPE, preexec_fn=limit_stack)
+        elapsed = time.time() - start
+    finally:
+        os.unlink(file.name)
+    if result.returncode != 0 or not result.stdout.startswith(b"FUNCTION"):
+        raise RuntimeError("exit status %d" % result.returncode)
+    return elapsed
+
+
+def main():
+    if len(sys.argv) < 2:
+        print("usage: %s <splc> [max_statements]" % sys.argv[0], file=sys.stderr)
+        return 2
+    splc = sys.argv[1]
+    largest = int(sys.argv[2]) if len(sys.argv) > 2 else 1000000
+    failed = False
+    for shape in (one_function, many_functions):
+        sizes = [largest >> i for i in range(3, -1, -1)]
+        previous = None
+        for n in sizes:
+            try:
+                elapsed = compile_time(splc, shape(n))
+            except RuntimeError as error:
+                print("%-16s %8d statements: FAIL (%s)" % (shape.__name__, n, error))
+                failed = True
+                break
+            growth = elapsed / previous if previous else None
+            slow = growth is not None and previous > 0.05 and growth > MAX_GROWTH
+            print("%-16s %8d statements: %6.2fs%s" % (shape.__name__, n, elapsed,
+                  " x%.2f%s" % (growth, " FAIL" if slow else "") if growth else ""))
+            failed = failed or slow
+            previous = elapsed
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())